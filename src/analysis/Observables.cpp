@@ -0,0 +1,86 @@
+#include "Observables.h"
+#include "BinaryIO.h"
+
+Observables::Observables() : numParticles(0), volume(1.0), beta(1.0) {}
+
+void Observables::reset(int particles, double boxVolume, double temperature) {
+    energy.reset();
+    virial.reset();
+    pressure.reset();
+    numParticles = particles;
+    volume = boxVolume;
+    beta = 1.0 / temperature;
+}
+
+void Observables::sample(double currentEnergy, double currentVirial) {
+    energy.add(currentEnergy);
+    virial.add(currentVirial);
+    pressure.add(numParticles / (beta * volume) + currentVirial / (3.0 * volume));
+}
+
+long long Observables::getSampleCount() const {
+    return energy.getCount();
+}
+
+double Observables::getEnergyPerParticle() const {
+    return numParticles > 0 ? energy.getMean() / numParticles : 0.0;
+}
+
+double Observables::getPressure() const {
+    return pressure.getMean();
+}
+
+double Observables::getHeatCapacity() const {
+    return numParticles > 0 ? beta * beta * energy.getVariance() / numParticles : 0.0;
+}
+
+double Observables::getCompressibilityFactor() const {
+    return numParticles > 0 ? beta * pressure.getMean() * volume / numParticles : 0.0;
+}
+
+const TimeSeries& Observables::getEnergyStat() const {
+    return energy;
+}
+
+const TimeSeries& Observables::getVirialStat() const {
+    return virial;
+}
+
+const TimeSeries& Observables::getPressureStat() const {
+    return pressure;
+}
+
+const TimeSeries& Observables::getSeries(Quantity quantity) const {
+    switch (quantity) {
+    case VIRIAL:
+        return virial;
+    case PRESSURE:
+        return pressure;
+    default:
+        return energy;
+    }
+}
+
+// Require a few dozen samples past the burn-in so an early, noisy error estimate cannot end a run
+bool Observables::isConverged(Quantity quantity, double targetError) const {
+    const TimeSeries& series = getSeries(quantity);
+    if (!series.isEquilibrated() || series.getCount() - series.getBurnIn() < 64) {
+        return false;
+    }
+    double error = series.getStandardError();
+    return error > 0.0 && error <= targetError;
+}
+
+void Observables::save(std::ostream& out) const {
+    energy.save(out);
+    virial.save(out);
+    pressure.save(out);
+    writeBinary(out, numParticles);
+    writeBinary(out, volume);
+    writeBinary(out, beta);
+}
+
+bool Observables::load(std::istream& in) {
+    return energy.load(in) && virial.load(in) && pressure.load(in) && readBinary(in, numParticles) &&
+           readBinary(in, volume) && readBinary(in, beta);
+}
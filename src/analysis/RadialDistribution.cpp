@@ -0,0 +1,161 @@
+#include "RadialDistribution.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+RadialDistribution::RadialDistribution(int bins, double radius, int interval)
+    : numBins(bins), maxRadius(radius), binWidth(0.0), sampleInterval(interval), samples(0), densitySum(0.0) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+    threadHistograms.assign(numThreads, std::vector<unsigned long long>(numBins, 0));
+}
+
+void RadialDistribution::reset() {
+    for (size_t t = 0; t < threadHistograms.size(); t++) {
+        std::fill(threadHistograms[t].begin(), threadHistograms[t].end(), 0);
+    }
+    samples = 0;
+    densitySum = 0.0;
+}
+
+// Each thread owns every numThreads-th cell and counts ordered pairs (i, j)
+// with i in one of its cells, so no histogram is written by two threads
+void RadialDistribution::accumulateCells(const Box& box, int thread) {
+    std::vector<unsigned long long>& histogram = threadHistograms[thread];
+    double maxRadius2 = binWidth * numBins * binWidth * numBins;
+    int range = cells.getNeighbourRange();
+
+    for (int cell = thread; cell < cells.getCellCount(); cell += numThreads) {
+        int cx, cy, cz;
+        cells.getCellCoordinates(cell, cx, cy, cz);
+        for (int i = cells.getHead(cell); i != -1; i = cells.getNext(i)) {
+            const Particle& pi = box.getParticle(i);
+            for (int dz = -range; dz <= range; dz++) {
+                for (int dy = -range; dy <= range; dy++) {
+                    for (int dx = -range; dx <= range; dx++) {
+                        int neighbour = cells.getCellIndex(cx + dx, cy + dy, cz + dz);
+                        for (int j = cells.getHead(neighbour); j != -1; j = cells.getNext(j)) {
+                            if (j == i) {
+                                continue;
+                            }
+                            double r2 = box.minimumImageDistanceSquared(pi, box.getParticle(j));
+                            if (r2 < maxRadius2) {
+                                int bin = std::min(static_cast<int>(std::sqrt(r2) / binWidth), numBins - 1);
+                                histogram[bin]++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Each thread takes every numThreads-th particle i and the pairs (i, j > i),
+// counted twice to match the ordered pairs of the cell loop; interleaving
+// the rows evens out the triangle
+void RadialDistribution::accumulatePairs(const Box& box, int thread) {
+    std::vector<unsigned long long>& histogram = threadHistograms[thread];
+    double maxRadius2 = binWidth * numBins * binWidth * numBins;
+    const Particle* particles = box.getParticles();
+    size_t count = box.getParticleCount();
+
+    for (size_t i = thread; i < count; i += numThreads) {
+        const Particle& pi = particles[i];
+        for (size_t j = i + 1; j < count; j++) {
+            double r2 = box.minimumImageDistanceSquared(pi, particles[j]);
+            if (r2 < maxRadius2) {
+                int bin = std::min(static_cast<int>(std::sqrt(r2) / binWidth), numBins - 1);
+                histogram[bin] += 2;
+            }
+        }
+    }
+}
+
+void RadialDistribution::sample(const Box& box) {
+    double radius = maxRadius > 0.0 ? std::min(maxRadius, box.getSize() / 2.0) : box.getSize() / 2.0;
+    binWidth = radius / numBins;
+    cells.build(box, radius);
+
+    void (RadialDistribution::*accumulate)(const Box&, int) =
+        cells.getCellCount() > 1 ? &RadialDistribution::accumulateCells : &RadialDistribution::accumulatePairs;
+    std::vector<std::thread> workers;
+    for (int t = 1; t < numThreads; t++) {
+        workers.push_back(std::thread(accumulate, this, std::cref(box), t));
+    }
+    (this->*accumulate)(box, 0);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    double count = static_cast<double>(box.getParticleCount());
+    densitySum += count * count / box.getVolume();
+    samples++;
+}
+
+// g(r) = pairs in shell / (N rho V_shell), averaged over the samples
+std::vector<float> RadialDistribution::getValues() const {
+    std::vector<float> values(numBins, 0.0f);
+    if (samples == 0) {
+        return values;
+    }
+    const double pi = 3.14159265358979323846;
+    for (int b = 0; b < numBins; b++) {
+        unsigned long long total = 0;
+        for (size_t t = 0; t < threadHistograms.size(); t++) {
+            total += threadHistograms[t][b];
+        }
+        double rLow = b * binWidth;
+        double rHigh = rLow + binWidth;
+        double shellVolume = 4.0 / 3.0 * pi * (rHigh * rHigh * rHigh - rLow * rLow * rLow);
+        values[b] = static_cast<float>(total / (densitySum * shellVolume));
+    }
+    return values;
+}
+
+long long RadialDistribution::getSampleCount() const {
+    return samples;
+}
+
+double RadialDistribution::getBinWidth() const {
+    return binWidth;
+}
+
+double RadialDistribution::getMaxRadius() const {
+    return binWidth * numBins;
+}
+
+int RadialDistribution::getSampleInterval() const {
+    return sampleInterval;
+}
+
+void RadialDistribution::setSampleInterval(int interval) {
+    sampleInterval = interval;
+}
+
+void RadialDistribution::save(std::ostream& out) const {
+    std::vector<unsigned long long> merged(numBins, 0);
+    for (size_t t = 0; t < threadHistograms.size(); t++) {
+        for (int b = 0; b < numBins; b++) {
+            merged[b] += threadHistograms[t][b];
+        }
+    }
+    writeBinary(out, maxRadius);
+    writeBinary(out, binWidth);
+    writeBinary(out, sampleInterval);
+    writeBinary(out, samples);
+    writeBinary(out, densitySum);
+    writeBinaryVector(out, merged);
+}
+
+bool RadialDistribution::load(std::istream& in) {
+    std::vector<unsigned long long> merged;
+    if (!readBinary(in, maxRadius) || !readBinary(in, binWidth) || !readBinary(in, sampleInterval) ||
+        !readBinary(in, samples) || !readBinary(in, densitySum) || !readBinaryVector(in, merged) || merged.empty()) {
+        return false;
+    }
+    numBins = static_cast<int>(merged.size());
+    threadHistograms.assign(numThreads, std::vector<unsigned long long>(numBins, 0));
+    threadHistograms[0] = merged;
+    return true;
+}
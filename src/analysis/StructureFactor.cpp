@@ -0,0 +1,239 @@
+#include "StructureFactor.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cmath>
+#include <thread>
+
+namespace {
+const double TWO_PI = 6.28318530717958647692;
+const size_t CHUNK = 256;  // Particles per block of phase tables
+}
+
+StructureFactor::StructureFactor(int maxIndex, int interval)
+    : maxIndex(maxIndex), sampleInterval(interval), boxSize(1.0), numParticles(0), samples(0) {}
+
+// exp(i 2 pi n x / L) for n = 0..maxIndex by complex recurrence, one sin/cos per coordinate
+void StructureFactor::axisPhases(double coordinate, double* re, double* im) const {
+    double angle = TWO_PI * coordinate / boxSize;
+    double c = std::cos(angle), s = std::sin(angle);
+    re[0] = 1.0;
+    im[0] = 0.0;
+    for (int n = 1; n <= maxIndex; n++) {
+        re[n] = re[n - 1] * c - im[n - 1] * s;
+        im[n] = re[n - 1] * s + im[n - 1] * c;
+    }
+}
+
+// Half-space of integer vectors with 0 < |n|^2 <= maxIndex^2, grouped into shells
+void StructureFactor::buildLattice() {
+    moveScratch.assign(12 * (maxIndex + 1), 0.0);
+    nx.clear();
+    ny.clear();
+    nz.clear();
+    std::vector<int> norms;
+    for (int a = 0; a <= maxIndex; a++) {
+        for (int b = -maxIndex; b <= maxIndex; b++) {
+            for (int c = -maxIndex; c <= maxIndex; c++) {
+                bool upperHalf = a > 0 || (a == 0 && (b > 0 || (b == 0 && c > 0)));
+                int norm2 = a * a + b * b + c * c;
+                if (upperHalf && norm2 <= maxIndex * maxIndex) {
+                    nx.push_back(a);
+                    ny.push_back(b);
+                    nz.push_back(c);
+                    norms.push_back(norm2);
+                }
+            }
+        }
+    }
+
+    shellNorm2 = norms;
+    std::sort(shellNorm2.begin(), shellNorm2.end());
+    shellNorm2.erase(std::unique(shellNorm2.begin(), shellNorm2.end()), shellNorm2.end());
+    shellCount.assign(shellNorm2.size(), 0);
+    shellOf.resize(norms.size());
+    for (size_t k = 0; k < norms.size(); k++) {
+        shellOf[k] = static_cast<int>(std::lower_bound(shellNorm2.begin(), shellNorm2.end(), norms[k]) - shellNorm2.begin());
+        shellCount[shellOf[k]]++;
+    }
+
+    rhoRe.assign(nx.size(), 0.0);
+    rhoIm.assign(nx.size(), 0.0);
+    sumS.assign(nx.size(), 0.0);
+}
+
+void StructureFactor::initialize(const Box& box) {
+    boxSize = box.getSize();
+    numParticles = box.getParticleCount();
+    samples = 0;
+    buildLattice();
+
+    xs.resize(numParticles);
+    ys.resize(numParticles);
+    zs.resize(numParticles);
+    for (size_t i = 0; i < numParticles; i++) {
+        const Particle& p = box.getParticle(i);
+        xs[i] = p.x;
+        ys[i] = p.y;
+        zs[i] = p.z;
+    }
+
+    // Threads split the k-vectors; each walks all particles in blocks
+    unsigned int numThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t perThread = (nx.size() + numThreads - 1) / numThreads;
+    std::vector<std::thread> workers;
+    for (unsigned int t = 1; t < numThreads; t++) {
+        size_t first = std::min(nx.size(), t * perThread);
+        size_t last = std::min(nx.size(), first + perThread);
+        workers.push_back(std::thread(&StructureFactor::computeRange, this, first, last));
+    }
+    computeRange(0, std::min(nx.size(), perThread));
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+}
+
+// rho(k) for k in [firstK, lastK) from the SoA positions. The phase tables are
+// laid out [axis][n][particle] so the innermost loop runs over contiguous memory.
+void StructureFactor::computeRange(size_t firstK, size_t lastK) {
+    size_t stride = static_cast<size_t>(maxIndex + 1) * CHUNK;
+    std::vector<double> cosTable(3 * stride), sinTable(3 * stride);
+    std::vector<double> re(maxIndex + 1), im(maxIndex + 1);
+    const std::vector<double>* axes[3] = {&xs, &ys, &zs};
+
+    for (size_t begin = 0; begin < numParticles; begin += CHUNK) {
+        size_t count = std::min(CHUNK, numParticles - begin);
+        for (int axis = 0; axis < 3; axis++) {
+            const std::vector<double>& coords = *axes[axis];
+            for (size_t j = 0; j < count; j++) {
+                axisPhases(coords[begin + j], &re[0], &im[0]);
+                for (int n = 0; n <= maxIndex; n++) {
+                    cosTable[axis * stride + n * CHUNK + j] = re[n];
+                    sinTable[axis * stride + n * CHUNK + j] = im[n];
+                }
+            }
+        }
+
+        for (size_t k = firstK; k < lastK; k++) {
+            const double* cx = &cosTable[0 * stride + nx[k] * CHUNK];
+            const double* sx = &sinTable[0 * stride + nx[k] * CHUNK];
+            const double* cy = &cosTable[1 * stride + std::abs(ny[k]) * CHUNK];
+            const double* sy = &sinTable[1 * stride + std::abs(ny[k]) * CHUNK];
+            const double* cz = &cosTable[2 * stride + std::abs(nz[k]) * CHUNK];
+            const double* sz = &sinTable[2 * stride + std::abs(nz[k]) * CHUNK];
+            double signY = ny[k] < 0 ? -1.0 : 1.0;
+            double signZ = nz[k] < 0 ? -1.0 : 1.0;
+
+            double sumRe = 0.0, sumIm = 0.0;
+            for (size_t j = 0; j < count; j++) {
+                double yr = cy[j], yi = signY * sy[j];
+                double zr = cz[j], zi = signZ * sz[j];
+                double pr = cx[j] * yr - sx[j] * yi;
+                double pi = cx[j] * yi + sx[j] * yr;
+                sumRe += pr * zr - pi * zi;
+                sumIm += pr * zi + pi * zr;
+            }
+            rhoRe[k] += sumRe;
+            rhoIm[k] += sumIm;
+        }
+    }
+}
+
+// Replace one particle's term in every rho(k)
+void StructureFactor::particleMoved(const Particle& oldPosition, const Particle& newPosition) {
+    if (nx.empty()) {
+        return;
+    }
+    double* table = &moveScratch[0];
+    double* oldRe[3];
+    double* oldIm[3];
+    double* newRe[3];
+    double* newIm[3];
+    double oldCoords[3] = {oldPosition.x, oldPosition.y, oldPosition.z};
+    double newCoords[3] = {newPosition.x, newPosition.y, newPosition.z};
+    for (int axis = 0; axis < 3; axis++) {
+        oldRe[axis] = &table[(4 * axis + 0) * (maxIndex + 1)];
+        oldIm[axis] = &table[(4 * axis + 1) * (maxIndex + 1)];
+        newRe[axis] = &table[(4 * axis + 2) * (maxIndex + 1)];
+        newIm[axis] = &table[(4 * axis + 3) * (maxIndex + 1)];
+        axisPhases(oldCoords[axis], oldRe[axis], oldIm[axis]);
+        axisPhases(newCoords[axis], newRe[axis], newIm[axis]);
+    }
+
+    for (size_t k = 0; k < nx.size(); k++) {
+        int a = nx[k], b = std::abs(ny[k]), c = std::abs(nz[k]);
+        double signY = ny[k] < 0 ? -1.0 : 1.0;
+        double signZ = nz[k] < 0 ? -1.0 : 1.0;
+
+        double pr = newRe[0][a] * newRe[1][b] - newIm[0][a] * signY * newIm[1][b];
+        double pi = newRe[0][a] * signY * newIm[1][b] + newIm[0][a] * newRe[1][b];
+        double addRe = pr * newRe[2][c] - pi * signZ * newIm[2][c];
+        double addIm = pr * signZ * newIm[2][c] + pi * newRe[2][c];
+
+        pr = oldRe[0][a] * oldRe[1][b] - oldIm[0][a] * signY * oldIm[1][b];
+        pi = oldRe[0][a] * signY * oldIm[1][b] + oldIm[0][a] * oldRe[1][b];
+        double subRe = pr * oldRe[2][c] - pi * signZ * oldIm[2][c];
+        double subIm = pr * signZ * oldIm[2][c] + pi * oldRe[2][c];
+
+        rhoRe[k] += addRe - subRe;
+        rhoIm[k] += addIm - subIm;
+    }
+}
+
+void StructureFactor::sample() {
+    if (numParticles == 0) {
+        return;
+    }
+    for (size_t k = 0; k < nx.size(); k++) {
+        sumS[k] += (rhoRe[k] * rhoRe[k] + rhoIm[k] * rhoIm[k]) / numParticles;
+    }
+    samples++;
+}
+
+void StructureFactor::getValues(std::vector<float>& k, std::vector<float>& s) const {
+    k.assign(shellNorm2.size(), 0.0f);
+    s.assign(shellNorm2.size(), 0.0f);
+    if (samples == 0) {
+        return;
+    }
+    std::vector<double> shellSum(shellNorm2.size(), 0.0);
+    for (size_t i = 0; i < sumS.size(); i++) {
+        shellSum[shellOf[i]] += sumS[i];
+    }
+    for (size_t shell = 0; shell < shellNorm2.size(); shell++) {
+        k[shell] = static_cast<float>(TWO_PI * std::sqrt(static_cast<double>(shellNorm2[shell])) / boxSize);
+        s[shell] = static_cast<float>(shellSum[shell] / (shellCount[shell] * samples));
+    }
+}
+
+long long StructureFactor::getSampleCount() const {
+    return samples;
+}
+
+int StructureFactor::getSampleInterval() const {
+    return sampleInterval;
+}
+
+void StructureFactor::setSampleInterval(int interval) {
+    sampleInterval = interval;
+}
+
+void StructureFactor::save(std::ostream& out) const {
+    writeBinary(out, maxIndex);
+    writeBinary(out, sampleInterval);
+    writeBinary(out, samples);
+    writeBinaryVector(out, rhoRe);
+    writeBinaryVector(out, rhoIm);
+    writeBinaryVector(out, sumS);
+}
+
+bool StructureFactor::load(std::istream& in, const Box& box) {
+    if (!readBinary(in, maxIndex) || !readBinary(in, sampleInterval) || !readBinary(in, samples)) {
+        return false;
+    }
+    boxSize = box.getSize();
+    numParticles = box.getParticleCount();
+    buildLattice();
+    size_t count = nx.size();
+    return readBinaryVector(in, rhoRe) && readBinaryVector(in, rhoIm) && readBinaryVector(in, sumS) &&
+           rhoRe.size() == count && rhoIm.size() == count && sumS.size() == count;
+}
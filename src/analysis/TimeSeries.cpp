@@ -0,0 +1,242 @@
+#include "TimeSeries.h"
+#include "BinaryIO.h"
+#include <algorithm>
+#include <cmath>
+
+RunningStat::RunningStat() : n(0), mean(0.0), m2(0.0) {}
+
+void RunningStat::add(double value) {
+    n++;
+    double delta = value - mean;
+    mean += delta / n;
+    m2 += delta * (value - mean);
+}
+
+void RunningStat::reset() {
+    n = 0;
+    mean = 0.0;
+    m2 = 0.0;
+}
+
+long long RunningStat::getCount() const {
+    return n;
+}
+
+double RunningStat::getMean() const {
+    return mean;
+}
+
+double RunningStat::getVariance() const {
+    return n > 1 ? m2 / (n - 1) : 0.0;
+}
+
+double RunningStat::getStandardError() const {
+    return n > 1 ? std::sqrt(getVariance() / n) : 0.0;
+}
+
+void RunningStat::save(std::ostream& out) const {
+    writeBinary(out, n);
+    writeBinary(out, mean);
+    writeBinary(out, m2);
+}
+
+bool RunningStat::load(std::istream& in) {
+    return readBinary(in, n) && readBinary(in, mean) && readBinary(in, m2);
+}
+
+TimeSeries::TimeSeries() {
+    reset();
+}
+
+void TimeSeries::reset() {
+    levels.assign(1, RunningStat());
+    pending.assign(1, 0.0);
+    hasPending.assign(1, false);
+    blockMeans.clear();
+    blockSize = 1;
+    partialSum = 0.0;
+    partialCount = 0;
+    totalSamples = 0;
+    fineStart = 0;
+    truncation = 0;
+    equilibrated = false;
+}
+
+void TimeSeries::add(double value) {
+    totalSamples++;
+
+    // Blocking cascade: every second value at a level completes a block one level up
+    double carry = value;
+    for (size_t level = 0; ; level++) {
+        if (level == levels.size()) {
+            levels.push_back(RunningStat());
+            pending.push_back(0.0);
+            hasPending.push_back(false);
+        }
+        levels[level].add(carry);
+        if (!hasPending[level]) {
+            pending[level] = carry;
+            hasPending[level] = true;
+            break;
+        }
+        carry = 0.5 * (pending[level] + carry);
+        hasPending[level] = false;
+    }
+
+    partialSum += value;
+    partialCount++;
+    if (partialCount == blockSize) {
+        addBlock(partialSum / blockSize);
+        partialSum = 0.0;
+        partialCount = 0;
+    }
+}
+
+void TimeSeries::addBlock(double mean) {
+    blockMeans.push_back(mean);
+    if (static_cast<int>(blockMeans.size()) == MAX_BLOCKS) {
+        for (int i = 0; i < MAX_BLOCKS / 2; i++) {
+            blockMeans[i] = 0.5 * (blockMeans[2 * i] + blockMeans[2 * i + 1]);
+        }
+        blockMeans.resize(MAX_BLOCKS / 2);
+        blockSize *= 2;
+    }
+    detectEquilibration();
+}
+
+// Marginal standard error rule on the block means: the truncation d minimising
+// var(retained) / (n - d) marks the end of the initial transient. A minimum in
+// the second half of the series means it is still drifting.
+void TimeSeries::detectEquilibration() {
+    int count = static_cast<int>(blockMeans.size());
+    if (count < 16) {
+        return;
+    }
+    double sum = 0.0, sumSquares = 0.0;
+    double best = -1.0;
+    int bestTruncation = 0;
+    for (int d = count - 1; d >= 0; d--) {
+        sum += blockMeans[d];
+        sumSquares += blockMeans[d] * blockMeans[d];
+        int retained = count - d;
+        if (d <= count / 2 && retained > 1) {
+            double mean = sum / retained;
+            double statistic = (sumSquares / retained - mean * mean) / retained;
+            if (best < 0.0 || statistic <= best) {
+                best = statistic;
+                bestTruncation = d;
+            }
+        }
+    }
+    truncation = bestTruncation;
+    equilibrated = truncation < count / 2;
+
+    // Restart the fine blocking whenever the burn-in extends past where it
+    // started, so the correlation analysis only sees equilibrated data
+    if (equilibrated && getBurnIn() > fineStart) {
+        levels.assign(1, RunningStat());
+        pending.assign(1, 0.0);
+        hasPending.assign(1, false);
+        fineStart = totalSamples;
+    }
+}
+
+long long TimeSeries::getCount() const {
+    return totalSamples;
+}
+
+long long TimeSeries::getBurnIn() const {
+    return truncation * blockSize;
+}
+
+bool TimeSeries::isEquilibrated() const {
+    return equilibrated;
+}
+
+double TimeSeries::getMean() const {
+    double sum = partialSum;
+    for (size_t b = truncation; b < blockMeans.size(); b++) {
+        sum += blockMeans[b] * blockSize;
+    }
+    long long count = totalSamples - getBurnIn();
+    return count > 0 ? sum / count : 0.0;
+}
+
+double TimeSeries::getVariance() const {
+    return levels[0].getVariance();
+}
+
+// The larger of the batch-means error over the retained coarse blocks and the
+// blocking plateau, taken as the largest error of any level with enough blocks
+double TimeSeries::getStandardError() const {
+    double error = 0.0;
+    RunningStat retained;
+    for (size_t b = truncation; b < blockMeans.size(); b++) {
+        retained.add(blockMeans[b]);
+    }
+    if (retained.getCount() > 1) {
+        error = retained.getStandardError();
+    }
+    for (size_t level = 0; level < levels.size(); level++) {
+        if (levels[level].getCount() >= 32) {
+            error = std::max(error, levels[level].getStandardError());
+        }
+    }
+    return error;
+}
+
+// tau = (g - 1) / 2 with statistical inefficiency g = n SE^2 / var
+double TimeSeries::getAutocorrelationTime() const {
+    double variance = levels[0].getVariance();
+    long long n = levels[0].getCount();
+    if (variance <= 0.0 || n < 2) {
+        return 0.0;
+    }
+    double plateau = 0.0;
+    for (size_t level = 0; level < levels.size(); level++) {
+        if (levels[level].getCount() >= 32) {
+            plateau = std::max(plateau, levels[level].getStandardError());
+        }
+    }
+    return std::max(0.0, 0.5 * (n * plateau * plateau / variance - 1.0));
+}
+
+void TimeSeries::save(std::ostream& out) const {
+    writeBinary(out, static_cast<uint64_t>(levels.size()));
+    for (size_t level = 0; level < levels.size(); level++) {
+        levels[level].save(out);
+        writeBinary(out, pending[level]);
+        writeBinary(out, static_cast<uint8_t>(hasPending[level]));
+    }
+    writeBinaryVector(out, blockMeans);
+    writeBinary(out, blockSize);
+    writeBinary(out, partialSum);
+    writeBinary(out, partialCount);
+    writeBinary(out, totalSamples);
+    writeBinary(out, fineStart);
+    writeBinary(out, truncation);
+    writeBinary(out, static_cast<uint8_t>(equilibrated));
+}
+
+bool TimeSeries::load(std::istream& in) {
+    uint64_t levelCount;
+    if (!readBinary(in, levelCount) || levelCount == 0) {
+        return false;
+    }
+    levels.assign(levelCount, RunningStat());
+    pending.assign(levelCount, 0.0);
+    hasPending.assign(levelCount, false);
+    for (size_t level = 0; level < levelCount; level++) {
+        uint8_t flag;
+        if (!levels[level].load(in) || !readBinary(in, pending[level]) || !readBinary(in, flag)) {
+            return false;
+        }
+        hasPending[level] = flag != 0;
+    }
+    uint8_t equilibratedFlag;
+    bool ok = readBinaryVector(in, blockMeans) && readBinary(in, blockSize) && readBinary(in, partialSum) &&
+              readBinary(in, partialCount) && readBinary(in, totalSamples) && readBinary(in, fineStart) &&
+              readBinary(in, truncation) && readBinary(in, equilibratedFlag);
+    equilibrated = ok && equilibratedFlag != 0;
+    return ok;
+}
@@ -0,0 +1,100 @@
+#ifndef ASYNCFILE_H
+#define ASYNCFILE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sequentially written output file with several writes in flight. write()
+// copies into one of BUFFER_COUNT page-aligned buffers; a full buffer is
+// submitted at its file offset and filling continues in the next one, so the
+// caller only waits when every buffer is still being written.
+//
+// The io_uring backend registers the buffers with the kernel once and submits
+// fixed-buffer writes through the submission ring, using the raw system calls
+// so no library is needed. Where io_uring is unavailable (old kernel, seccomp,
+// locked-memory limit) a helper thread issues pwrite() for each buffer instead.
+class AsyncFile {
+public:
+    enum Backend { AUTO, IO_URING, PWRITE_THREAD };
+    static const size_t BUFFER_BYTES = 1 << 20;
+    static const size_t BUFFER_COUNT = 8;
+
+private:
+    struct Ring;  // io_uring state, defined in AsyncFile.cpp
+    struct Write {
+        uint64_t offset;
+        size_t done;      // Bytes already written
+    };
+
+    int fd;
+    Backend backend;
+    std::unique_ptr<Ring> ring;
+    std::vector<char*> buffers;
+    std::vector<size_t> fill;       // Bytes in each buffer
+    std::vector<Write> writes;      // Write in flight for each buffer
+    std::vector<unsigned char> busy;
+    size_t current;                 // Buffer being filled
+    uint64_t offset;                // File offset of the current buffer
+    size_t inFlight;
+    std::atomic<bool> failed;
+
+    std::thread worker;             // PWRITE_THREAD only
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<size_t> queue;
+    bool stopping;
+
+    static Backend defaultBackend;
+
+    bool setupRing();
+    void closeRing();
+    void submit(size_t buffer);
+    void pushRingWrite(size_t buffer);
+    void reap(bool wait);
+    void waitFor(size_t buffer);
+    void waitAll();
+    void writeLoop();
+
+    AsyncFile(const AsyncFile&);
+    AsyncFile& operator=(const AsyncFile&);
+
+public:
+    AsyncFile();
+    ~AsyncFile();
+    // Appends to an existing file rather than truncating it when append is set
+    bool open(const std::string& filename, bool append = false, Backend requested = AUTO);
+    bool write(const void* data, size_t size);
+    bool flush();   // Submits the partly filled buffer and waits for every write
+    bool sync();    // flush(), then fsync()
+    bool close();   // False if any write since open() failed
+    bool isOpen() const;
+    Backend getBackend() const;
+    uint64_t getSize() const;       // Bytes written since open(), plus the existing length when appending
+
+    static void setDefaultBackend(Backend requested);  // Used when open() is given AUTO
+    static const char* getBackendName(Backend value);
+};
+
+// Lets std::ostream serialisation code write through an AsyncFile
+class AsyncFileStreamBuffer : public std::streambuf {
+private:
+    AsyncFile& file;
+
+protected:
+    std::streamsize xsputn(const char* data, std::streamsize count) override;
+    int_type overflow(int_type c) override;
+
+public:
+    explicit AsyncFileStreamBuffer(AsyncFile& target);
+};
+
+#endif // ASYNCFILE_H
@@ -0,0 +1,44 @@
+#ifndef BINARYIO_H
+#define BINARYIO_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+// Raw native-endian serialisation of trivially copyable values and vectors of
+// them, used by the checkpoint format. Reads report failure instead of
+// throwing so a truncated file can be rejected cleanly.
+template <typename T>
+void writeBinary(std::ostream& out, const T& value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readBinary(std::istream& in, T& value) {
+    in.read(reinterpret_cast<char*>(&value), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+template <typename T>
+void writeBinaryVector(std::ostream& out, const std::vector<T>& values) {
+    writeBinary(out, static_cast<uint64_t>(values.size()));
+    if (!values.empty()) {
+        out.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+}
+
+template <typename T>
+bool readBinaryVector(std::istream& in, std::vector<T>& values) {
+    uint64_t count;
+    if (!readBinary(in, count)) {
+        return false;
+    }
+    values.resize(count);
+    if (count > 0) {
+        in.read(reinterpret_cast<char*>(values.data()), count * sizeof(T));
+    }
+    return static_cast<bool>(in);
+}
+
+#endif // BINARYIO_H
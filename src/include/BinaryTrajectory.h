@@ -0,0 +1,83 @@
+#ifndef BINARYTRAJECTORY_H
+#define BINARYTRAJECTORY_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "TrajectorySink.h"
+
+// Binary trajectory layout (little-endian, as written by the host):
+//
+//   header   64 bytes   BinaryTrajectoryHeader
+//   frames   fixed size int64 step, then the x, y and z columns of N floats
+//                       or doubles each (structure of arrays)
+//   index    8 * F      uint64 byte offset of every frame
+//   footer   24 bytes   uint64 frame count, uint64 index offset, "MCSIDX\0\0"
+//
+// Frames are fixed size, so a file without its index (e.g. after a crash) is
+// still readable; the reader then derives the frame count from the file size.
+struct BinaryTrajectoryHeader {
+    char magic[8];          // "MCSTRAJ\0"
+    uint32_t version;
+    uint32_t precision;     // Bytes per coordinate, 4 or 8
+    uint64_t particleCount;
+    double boxSize;
+    uint64_t seed;
+    uint64_t reserved[3];
+};
+
+class BinaryTrajectorySink : public TrajectorySink {
+private:
+    AsyncFile file;
+    BinaryTrajectoryHeader header;
+    std::vector<uint64_t> offsets;
+    std::vector<char> column;   // One coordinate column in the file precision
+    bool headerWritten;
+
+    void writeColumn(const Frame& frame, int axis);
+
+public:
+    BinaryTrajectorySink(int precision = 8, uint64_t seed = 0);
+    bool open(const std::string& filename, double boxSize) override;
+    bool write(const Frame& frame) override;
+    bool hasFixedParticleCount() const override;
+    void flush() override;
+    void close() override;  // Appends the frame index and footer
+};
+
+// Memory-mapped reader with O(1) access to any frame
+class BinaryTrajectoryReader {
+private:
+    int fd;
+    const char* data;
+    size_t fileSize;
+    const BinaryTrajectoryHeader* header;
+    size_t frameSize;
+    size_t frameCount;
+
+public:
+    BinaryTrajectoryReader();
+    ~BinaryTrajectoryReader();
+    bool open(const std::string& filename);
+    void close();
+
+    size_t getFrameCount() const;
+    size_t getParticleCount() const;
+    double getBoxSize() const;
+    uint64_t getSeed() const;
+    int getPrecision() const;
+    int64_t getStep(size_t frame) const;
+    const void* getColumn(size_t frame, int axis) const;  // Points into the mapping
+    void readFrame(size_t frame, std::vector<Particle>& particles) const;
+};
+
+// Conversion to and from the LAMMPS text dump written by saveParticles, of
+// frames first to last (from 0, inclusive). A dump is entered at the first
+// frame through its sidecar index.
+bool convertLammpsToBinary(const std::string& input, const std::string& output, int precision = 8, size_t first = 0,
+                           size_t last = SIZE_MAX);
+bool convertBinaryToLammps(const std::string& input, const std::string& output, size_t first = 0,
+                           size_t last = SIZE_MAX);
+
+#endif // BINARYTRAJECTORY_H
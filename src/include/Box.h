@@ -2,24 +2,71 @@
 #define BOX_H
 
 #include <cstddef>  // Add this line to include size_t
+#include <iosfwd>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Particle.h"
+#include "BoxSnapshot.h"
+#include "DirtyRanges.h"
+#include "StateFile.h"
 
+// Particles live in one contiguous array for the pair loops. Snapshots are
+// taken copy-on-write: the box keeps the chunks of its last snapshot and
+// notes which chunks were modified since, so the next snapshot copies only
+// those. All modifications therefore go through the methods below.
+//
+// The array is either on the heap or in a StateFile, which keeps it in a file
+// mapping that survives the process. A copy of a box is always on the heap;
+// assigning to a box keeps its storage.
 class Box {
 private:
     double size;
-    std::vector<Particle> particles;
+    Particle* particles;                  // heapParticles.data() or the state file's array
+    size_t count;
+    std::vector<Particle> heapParticles;  // Unused while a state file is open
+    std::unique_ptr<StateFile> state;
+    std::vector<std::shared_ptr<const ParticleChunk>> sharedChunks;  // Chunks of the last snapshot
+    std::vector<unsigned char> dirtyChunks;                           // Modified since then
+    DirtyRanges changedRanges;                                        // Modified since takeChangedRanges()
+
+    void markDirty(size_t index);
+    void markAllDirty();
+    bool resize(size_t particleCount);
 
 public:
     Box(double box_size);
+    Box(const Box& other);
+    Box& operator=(const Box& other);  // Use assign() when a state file may be open
+    bool assign(const Box& other);     // False, leaving this box as it was, if the state file cannot grow
     void addParticle(const Particle& particle);
+    double minimumImageDistanceSquared(const Particle& p1, const Particle& p2) const;
     double calculateLennardJonesPotential(const Particle& p1, const Particle& p2) const;
     double calculateTotalEnergy() const;
+    double calculateParticleEnergy(const Particle& particle, size_t skipIndex) const;  // Energy of particle with all others except skipIndex
+    void calculateTotals(double& energy, double& virial) const;
+    void calculateMoveDelta(size_t index, const Particle& trial, double& dE, double& dW) const;  // Energy and virial change of moving index to trial
     void applyPeriodicBoundaryConditions(Particle& particle);
-    Particle& getParticle(int index) const;
+    const Particle& getParticle(size_t index) const;
+    void setParticle(size_t index, const Particle& particle);
+    const Particle* getParticles() const;  // Contiguous array of getParticleCount() particles
     size_t getParticleCount() const;  // Now size_t is properly defined
     double getSize() const;
+    double getVolume() const;
+    void setSize(double newSize);      // Rescales particle positions affinely
+    void removeParticle(size_t index); // Swaps with the last particle, so order is not preserved
     void clearParticles();
+    BoxSnapshot snapshot(int step);  // Shares the chunks unchanged since the previous snapshot
+    DirtyRanges takeChangedRanges();  // Indices modified since the previous call, normalised
+
+    void save(std::ostream& out) const;  // Size and positions, bit for bit
+    bool load(std::istream& in);
+
+    // Persistent storage of the particle array
+    bool createStateFile(const std::string& filename);  // Moves the particles into a new file
+    bool openStateFile(const std::string& filename);    // Maps an existing file in place of the particles
+    void closeStateFile();                              // Moves the particles back to the heap
+    StateFile* getStateFile();                          // Null while the particles are on the heap
 };
 
 #endif // BOX_H
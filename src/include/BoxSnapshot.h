@@ -0,0 +1,43 @@
+#ifndef BOXSNAPSHOT_H
+#define BOXSNAPSHOT_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "Particle.h"
+
+typedef std::vector<Particle> ParticleChunk;
+
+// Immutable configuration of a Box at one step, held as reference-counted
+// chunks of CHUNK_PARTICLES particles. Consecutive snapshots share every
+// chunk that did not change in between, so taking one costs a pointer per
+// chunk plus a copy of the modified chunks only. Snapshots never change once
+// taken and may be read from any thread.
+class BoxSnapshot {
+public:
+    static const size_t CHUNK_PARTICLES = 1024;
+
+private:
+    int step;
+    double boxSize;
+    size_t count;
+    std::vector<std::shared_ptr<const ParticleChunk>> chunks;
+
+    friend class Box;
+
+public:
+    BoxSnapshot();
+    BoxSnapshot(int step, double boxSize, const Particle* particles, size_t count);  // Copies into new chunks
+    void clear();  // Drops the references to the chunks
+
+    int getStep() const;
+    double getBoxSize() const;
+    size_t getParticleCount() const;
+    size_t getChunkCount() const;
+    const ParticleChunk& getChunk(size_t chunk) const;
+    const Particle& getParticle(size_t index) const;
+    void copyTo(Particle* out) const;  // All particles into a contiguous array
+    bool sharesChunk(const BoxSnapshot& other, size_t chunk) const;
+};
+
+#endif // BOXSNAPSHOT_H
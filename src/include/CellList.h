@@ -0,0 +1,29 @@
+#ifndef CELLLIST_H
+#define CELLLIST_H
+
+#include <vector>
+#include "Box.h"
+
+// Linked-cell neighbour structure over the periodic box. Cells are at least
+// minCellSize wide, so all pairs closer than that lie in adjacent cells.
+class CellList {
+private:
+    int cellsPerSide;
+    double cellSize;
+    std::vector<int> head;  // First particle of each cell, -1 when empty
+    std::vector<int> next;  // Next particle in the same cell, -1 at the end
+
+public:
+    CellList();
+    void build(const Box& box, double minCellSize);
+
+    int getCellsPerSide() const;
+    int getCellCount() const;
+    int getCellIndex(int ix, int iy, int iz) const;  // Wraps periodically
+    void getCellCoordinates(int cell, int& ix, int& iy, int& iz) const;
+    int getNeighbourRange() const;  // 1 when cells wrap cleanly, 0 when everything is one cell
+    int getHead(int cell) const;
+    int getNext(int particle) const;
+};
+
+#endif // CELLLIST_H
@@ -0,0 +1,80 @@
+#ifndef COMPRESSEDTRAJECTORY_H
+#define COMPRESSEDTRAJECTORY_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "TrajectorySink.h"
+
+// Lossy compressed trajectory (.mcz).
+//
+// Coordinates are quantised onto M = ceil(1 / precision) levels per box
+// length, so every decoded coordinate is within precision * L / 2 of the
+// original (modulo the periodic image). Each frame stores, per particle and
+// axis, the change of the quantised value since the previous frame, wrapped
+// to the shortest periodic difference; every keyframeInterval-th frame is
+// stored against zero so decoding can restart there. The zigzag-mapped
+// differences are Rice coded with a parameter chosen per block of values.
+//
+// Particles are split into chunks that are encoded independently on
+// separate threads; a frame records the byte length of each chunk.
+struct CompressedTrajectoryHeader {
+    char magic[8];            // "MCSZTRJ\0"
+    uint32_t version;
+    uint32_t keyframeInterval;
+    uint64_t particleCount;
+    uint64_t levels;          // M
+    double boxSize;
+    double precision;         // Relative to the box length
+    uint64_t seed;
+};
+
+class CompressedTrajectorySink : public TrajectorySink {
+private:
+    AsyncFile file;
+    CompressedTrajectoryHeader header;
+    bool headerWritten;
+    uint64_t framesWritten;
+    int numThreads;
+    std::vector<uint32_t> previous;              // Quantised coordinates of the last frame, xyz interleaved
+    std::vector<std::vector<uint8_t>> chunkData;
+
+    void encodeChunk(const Frame& frame, size_t chunk, bool keyframe);
+
+public:
+    CompressedTrajectorySink(double precision = 1e-4, int keyframeInterval = 100, uint64_t seed = 0);
+    bool open(const std::string& filename, double boxSize) override;
+    bool write(const Frame& frame) override;
+    bool hasFixedParticleCount() const override;
+    void flush() override;
+    void close() override;
+};
+
+// Sequential decoder; frames depend on their predecessors back to a keyframe.
+// A header or frame that does not fit the file is reported and ends the read.
+class CompressedTrajectoryReader {
+private:
+    std::ifstream file;
+    CompressedTrajectoryHeader header;
+    uint64_t fileSize;
+    std::vector<uint32_t> previous;
+    std::vector<uint8_t> buffer;
+
+public:
+    CompressedTrajectoryReader();
+    bool open(const std::string& filename);
+    bool next(int& step, std::vector<Particle>& particles);
+    size_t getParticleCount() const;
+    double getBoxSize() const;
+    double getMaxError() const;  // Absolute bound on the coordinate error
+};
+
+// Conversion to and from the LAMMPS text dump written by saveParticles, of
+// frames first to last (from 0, inclusive), as for the binary trajectory
+bool convertLammpsToCompressed(const std::string& input, const std::string& output, double precision,
+                               size_t first = 0, size_t last = SIZE_MAX);
+bool convertCompressedToLammps(const std::string& input, const std::string& output, size_t first = 0,
+                               size_t last = SIZE_MAX);
+
+#endif // COMPRESSEDTRAJECTORY_H
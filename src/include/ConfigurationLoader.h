@@ -0,0 +1,27 @@
+#ifndef CONFIGURATIONLOADER_H
+#define CONFIGURATIONLOADER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Particle.h"
+
+// One frame of a trajectory, used as the starting configuration of a run
+struct Configuration {
+    int64_t step;
+    double boxSize;  // 0 when the file does not record one
+    std::vector<Particle> particles;
+};
+
+// Reads frame `frame` (counting from 0, or -1 for the last) of
+//  - a LAMMPS text dump with id, x, y and z columns, as written by saveParticles
+//  - an XYZ file: a count line, a comment line, then "type x y z" per particle;
+//    the box is read from an extended-XYZ Lattice="L 0 0 0 L 0 0 0 L" comment
+//  - a binary (.mctraj) or compressed (.mcz) trajectory
+//  - a move log (.mclog), where `frame` is the step to rebuild
+// Text files are mapped into memory and their particle lines parsed on
+// several threads. A LAMMPS frame is located through the dump's sidecar
+// index when an up-to-date one exists.
+bool loadConfiguration(const std::string& filename, long long frame, Configuration& configuration);
+
+#endif // CONFIGURATIONLOADER_H
@@ -0,0 +1,40 @@
+#ifndef DIRTYRANGES_H
+#define DIRTYRANGES_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Particle index ranges [first, second) changed since some point, for
+// consumers that copy the particles incrementally, such as the renderer's
+// vertex buffer. Single indices are appended as they come, one per accepted
+// move, and only sorted and merged by normalise(). Past MAX_ENTRIES entries
+// the set stops recording and counts as everything changed, so a consumer
+// that never collects it costs a bounded amount of memory.
+class DirtyRanges {
+public:
+    typedef std::pair<size_t, size_t> Range;
+    static const size_t MAX_ENTRIES = 1 << 16;
+    static const size_t MERGE_GAP = 16;  // Unchanged particles bridged to save separate copies
+
+private:
+    std::vector<Range> ranges;
+    bool all;
+    bool normalised;
+
+public:
+    DirtyRanges();
+    void add(size_t index);
+    void addRange(size_t first, size_t last);  // [first, last)
+    void markAll();
+    void merge(const DirtyRanges& other);
+    void clear();
+    void normalise();  // Sorts and merges overlapping and nearby ranges
+
+    bool isAll() const;
+    bool isEmpty() const;
+    const std::vector<Range>& getRanges() const;  // Normalised only after normalise()
+    size_t getParticleCount() const;              // Covered by the ranges, counting overlaps twice until normalised
+};
+
+#endif // DIRTYRANGES_H
@@ -0,0 +1,56 @@
+#ifndef GIBBSENSEMBLE_H
+#define GIBBSENSEMBLE_H
+
+#include "Box.h"
+#include <random>
+
+// Gibbs-ensemble Monte Carlo (NVT) with two coexisting boxes. Each cycle runs
+// the intra-box displacement sweeps of both boxes concurrently, then performs
+// the inter-box volume exchange and particle transfer moves serially.
+class GibbsEnsemble {
+private:
+    Box boxes[2];
+    double energies[2];
+    std::mt19937 boxRngs[2];   // One generator per box so the sweeps never share state
+    std::mt19937 exchangeRng;  // Used by the serial volume and transfer moves
+    double beta;
+    double maxDisplacement;
+    double maxLogVolumeChange;
+    int volumeMovesPerCycle;
+    int transfersPerCycle;
+
+    long long displacementAttempts[2], displacementAccepts[2];
+    long long volumeAttempts, volumeAccepts;
+    long long transferAttempts, transferAccepts;
+
+    double uniform(std::mt19937& rng);
+    void displacementSweep(int which);
+    void volumeMove();
+    void transferMove();
+
+public:
+    GibbsEnsemble(int particlesA, int particlesB, double sizeA, double sizeB, double temperature);
+
+    // Initialization and execution
+    void initialize(unsigned int seed);
+    void cycle();                       // One sweep per box followed by the exchange moves
+    void run(int cycles);
+
+    // Parameter setters and getters
+    void setMaxDisplacement(double delta);
+    void setMaxLogVolumeChange(double delta);
+    void setVolumeMovesPerCycle(int moves);
+    void setTransfersPerCycle(int moves);
+    double getTemperature() const;
+    void setTemperature(double temp);
+
+    // Observables
+    Box& getBox(int which);
+    double getEnergy(int which) const;
+    double getDensity(int which) const;
+    double getDisplacementAcceptance(int which) const;
+    double getVolumeAcceptance() const;
+    double getTransferAcceptance() const;
+};
+
+#endif // GIBBSENSEMBLE_H
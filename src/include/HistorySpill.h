@@ -0,0 +1,85 @@
+#ifndef HISTORYSPILL_H
+#define HISTORYSPILL_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "BoxSnapshot.h"
+#include "QuantisedFrame.h"
+
+// Place of a full-precision frame in a spill file
+struct SpilledFrame {
+    uint64_t offset;
+    int step;
+    double boxSize;
+    size_t count;
+};
+
+// Reads spilled frames with pread through a descriptor of its own, so it can
+// be used on another thread while the spill keeps growing or is cleared
+class SpillReader {
+private:
+    int fd;
+
+    SpillReader(const SpillReader&);
+    SpillReader& operator=(const SpillReader&);
+
+public:
+    explicit SpillReader(int descriptor);
+    ~SpillReader();
+    bool read(const SpilledFrame& frame, std::vector<Particle>& particles) const;
+};
+
+// Frames evicted from the in-memory history, appended to a scratch file on
+// local disk and read back through a shared memory mapping of it. Frames are
+// written with pwrite, so they never occupy the process's memory until read;
+// the kernel pages them in on access and may drop them again at any time.
+// The file is unlinked as soon as it is created and never outlives the
+// process. Clearing the spill starts a new file, so a SpillReader still
+// holding the old one keeps reading the frames it was given.
+class HistorySpill {
+private:
+    struct Entry {
+        uint64_t offset;
+        int step;
+        double boxSize;
+        size_t count;
+        bool quantised;
+    };
+
+    std::string directory;
+    int fd;
+    char* data;
+    uint64_t mappedBytes;  // Length of the file and of the mapping
+    uint64_t usedBytes;
+    std::vector<Entry> entries;
+
+    bool reserve(uint64_t bytes);
+    bool write(const void* buffer, size_t bytes, uint64_t& offset);
+    void addEntry(const Entry& entry, uint64_t end);
+    const char* pageIn(const Entry& entry) const;
+
+    HistorySpill(const HistorySpill&);
+    HistorySpill& operator=(const HistorySpill&);
+
+public:
+    HistorySpill();
+    ~HistorySpill();
+    bool open(const std::string& directory);
+    void close();
+    bool isOpen() const;
+    void clear();  // Drops every frame
+
+    bool append(const BoxSnapshot& snapshot);  // Fails when the disk is full
+    bool append(const QuantisedFrame& frame);   // Kept quantised on disk too
+    size_t size() const;
+    int getStep(size_t frame) const;
+    BoxSnapshot getFrame(size_t frame) const;  // 0 is the oldest
+    void getQuantisedFrame(size_t frame, QuantisedFrame& quantised) const;
+    bool locate(size_t frame, SpilledFrame& location) const;  // False for a frame spilled quantised
+    std::shared_ptr<SpillReader> share() const;                // Reader of the current file, nullptr when closed
+    uint64_t getBytes() const;
+};
+
+#endif // HISTORYSPILL_H
@@ -0,0 +1,25 @@
+#ifndef LAMMPSDUMPREADER_H
+#define LAMMPSDUMPREADER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "Particle.h"
+
+// Sequential reader for LAMMPS text dumps with id, x, y and z columns (in
+// any order), such as those written by LammpsDumpSink
+class LammpsDumpReader {
+private:
+    std::ifstream file;
+
+public:
+    bool open(const std::string& filename);
+    bool seek(uint64_t offset);  // To a frame start, e.g. from a LammpsFrameIndex
+    // To frame `frame` (from 0) of the open dump `filename`, through its sidecar index, built or extended as needed
+    bool seekFrame(const std::string& filename, size_t frame);
+    // Reads the next frame; particles are placed by id. Returns false at the end or on a malformed frame.
+    bool next(int& step, double& boxSize, std::vector<Particle>& particles);
+};
+
+#endif // LAMMPSDUMPREADER_H
@@ -0,0 +1,51 @@
+#ifndef LAMMPSFRAMEINDEX_H
+#define LAMMPSFRAMEINDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Byte offset and timestep of every frame of a LAMMPS text dump, so frame k
+// can be read without parsing the frames before it. The index is kept next
+// to the dump in a small sidecar file (<dump>.idx):
+//
+//   header   48 bytes   "MCSLIDX\0", uint32 version, uint32 reserved,
+//                       uint64 dump size, int64 dump mtime (s, ns), uint64 count
+//   entries  16 * F     uint64 offset of the ITEM: TIMESTEP line, int64 step
+//
+// The recorded size and modification time detect a stale index. A dump that
+// has only grown since, such as one still being streamed to, is indexed
+// incrementally from its last indexed frame, provided a sample of the earlier
+// frames are still at their offsets with their steps; otherwise, e.g. after the
+// dump was rewritten, it is scanned again from the start.
+class LammpsFrameIndex {
+private:
+    std::vector<uint64_t> offsets;
+    std::vector<int64_t> steps;
+    uint64_t dumpSize;
+    int64_t dumpSeconds;
+    int64_t dumpNanoseconds;
+
+    bool hasFrame(const char* data, const char* end, size_t frame) const;
+    bool scan(const std::string& dumpFile, uint64_t from);
+
+public:
+    LammpsFrameIndex();
+    static std::string sidecarFilename(const std::string& dumpFile);
+
+    bool build(const std::string& dumpFile);  // Scans the whole dump in parallel
+    bool save(const std::string& indexFile) const;
+    bool load(const std::string& indexFile);
+    bool isCurrent(const std::string& dumpFile) const;  // Matches the dump's size and modification time
+    // Loads the sidecar, bringing it up to date (and rewriting it) if the dump has changed
+    bool open(const std::string& dumpFile);
+
+    size_t getFrameCount() const;
+    uint64_t getOffset(size_t frame) const;
+    int64_t getStep(size_t frame) const;
+};
+
+// First ITEM: TIMESTEP line at or after p in the dump mapped at [data, end), or end
+const char* findLammpsTimestep(const char* data, const char* p, const char* end);
+
+#endif // LAMMPSFRAMEINDEX_H
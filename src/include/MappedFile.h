@@ -0,0 +1,28 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+private:
+    int fd;
+    const char* data;
+    size_t size;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+public:
+    MappedFile();
+    ~MappedFile();
+    bool open(const std::string& filename, bool sequential = true);  // sequential hints the kernel to read ahead
+    void close();
+
+    const char* getData() const;
+    const char* getEnd() const;
+    size_t getSize() const;
+};
+
+#endif // MAPPEDFILE_H
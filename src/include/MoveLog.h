@@ -0,0 +1,134 @@
+#ifndef MOVELOG_H
+#define MOVELOG_H
+
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "BoxSnapshot.h"
+#include "Particle.h"
+#include "TrajectorySink.h"
+
+// One accepted move: particle `index` is at (x, y, z) from step `step` on
+struct MoveEvent {
+    int32_t step;
+    uint32_t index;
+    double x, y, z;
+};
+
+// Moves of the steps after the previous segment up to lastStep, then the
+// keyframe at lastStep unless the segment ends between keyframes (empty
+// keyframe). This is what a move log streams to its trajectory file.
+struct MoveLogSegment {
+    std::vector<MoveEvent> events;
+    int lastStep;
+    BoxSnapshot keyframe;
+};
+
+// Trajectory recorded as accepted moves plus a full keyframe every
+// keyframeInterval steps. A Metropolis step changes at most one particle, so
+// this costs 32 bytes per accepted move instead of 24 N bytes per saved
+// frame, and any step in the recorded range can be rebuilt by replaying the
+// moves after the nearest keyframe before it. Past the memory limit the
+// oldest keyframes and the moves they cover are dropped, so the log holds
+// the most recent stretch of the run; once it is streamed to a file, only
+// what has not been written yet is kept.
+//
+// File layout (.mclog, host byte order): 64-byte MoveLogHeader, then blocks
+// in step order, each a MoveLogBlock followed by `count` particles of a
+// keyframe or `count` events of the steps up to `step`. The first block is a
+// keyframe. Blocks are appended as they are recorded, so a file cut short
+// reads back up to its last whole block.
+struct MoveLogHeader {
+    char magic[8];          // "MCSMLOG\0"
+    uint32_t version;
+    uint32_t reserved0;
+    uint64_t particleCount;
+    double boxSize;
+    uint64_t seed;
+    uint64_t reserved[3];
+};
+
+struct MoveLogBlock {
+    uint32_t type;          // MOVE_LOG_KEYFRAME or MOVE_LOG_MOVES
+    int32_t step;           // Keyframe step, or the last step the moves cover
+    uint64_t count;         // Particles or events that follow
+};
+
+const uint32_t MOVE_LOG_KEYFRAME = 1;
+const uint32_t MOVE_LOG_MOVES = 2;
+
+class MoveLog {
+public:
+    static const size_t DEFAULT_MEMORY_LIMIT = static_cast<size_t>(256) << 20;
+
+private:
+    size_t particleCount;
+    int keyframeInterval;
+    double boxSize;
+    int lastStep;
+    std::vector<int> keyframeSteps;       // Ascending
+    std::vector<BoxSnapshot> keyframes;   // Shared with the history they were taken for
+    std::vector<MoveEvent> events;        // In step order
+    size_t memoryLimit;                   // 0 for none
+
+    size_t bytesAfterDropping(size_t keyframes) const;
+    void drop(size_t keyframes);  // The oldest keyframes and the moves up to the next one
+    void dropOldest();
+
+public:
+    MoveLog();
+    void start(const BoxSnapshot& initial, int interval);
+    void clear();
+    bool isStarted() const;
+    void setMemoryLimit(size_t bytes);
+
+    void recordMove(int step, size_t index, const Particle& position);
+    // Marks step as complete; true when a keyframe is due, on every keyframeInterval'th step
+    bool endStep(int step);
+    void addKeyframe(const BoxSnapshot& keyframe);
+
+    // Configuration at any step from the first keyframe to the last recorded step
+    bool reconstruct(int step, std::vector<Particle>& particles) const;
+    // Keyframes and moves after afterStep, as segments ending at each keyframe and at the last step
+    void getSegments(int afterStep, std::vector<MoveLogSegment>& segments) const;
+    void discardBefore(int step);  // Keeps what reconstructing step and later steps needs
+
+    // Reads what reconstructing firstStep to lastStep needs, validating every block against the file
+    bool load(const std::string& filename, int firstStep = 0, int lastStep = INT_MAX);
+
+    int getFirstStep() const;
+    int getLastStep() const;
+    size_t getParticleCount() const;
+    double getBoxSize() const;
+    size_t getKeyframeCount() const;
+    int getKeyframeStep(size_t keyframe) const;
+    size_t getEventCount() const;
+    size_t getMemoryBytes() const;
+};
+
+// Streams MoveLogSegments to a .mclog file; write() takes the keyframes
+class MoveLogSink : public TrajectorySink {
+private:
+    AsyncFile file;
+    MoveLogHeader header;
+    bool headerWritten;
+    int lastStep;
+
+public:
+    explicit MoveLogSink(uint64_t seed = 0);
+    bool open(const std::string& filename, double boxSize) override;
+    bool write(const Frame& frame) override;
+    bool writeMoves(const MoveEvent* moves, size_t count, int step) override;
+    bool acceptsMoves() const override;
+    bool hasFixedParticleCount() const override;
+    void flush() override;
+    void close() override;
+};
+
+// Writes steps firstStep to lastStep of a move log, every `every` steps, or
+// its keyframes when every is 0, to a trajectory in the format the output
+// filename selects
+bool convertMoveLog(const std::string& input, const std::string& output, int firstStep, int lastStep, int every);
+
+#endif // MOVELOG_H
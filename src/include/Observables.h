@@ -0,0 +1,41 @@
+#ifndef OBSERVABLES_H
+#define OBSERVABLES_H
+
+#include "TimeSeries.h"
+
+// Thermodynamic accumulators fed with the running energy and virial of the
+// configuration; nothing here needs the particle positions.
+class Observables {
+public:
+    enum Quantity { ENERGY, VIRIAL, PRESSURE };
+
+private:
+    TimeSeries energy;
+    TimeSeries virial;
+    TimeSeries pressure;
+    int numParticles;
+    double volume;
+    double beta;
+
+public:
+    Observables();
+    void reset(int particles, double boxVolume, double temperature);
+    void sample(double currentEnergy, double currentVirial);
+
+    long long getSampleCount() const;
+    double getEnergyPerParticle() const;
+    double getPressure() const;               // P = rho T + <W> / 3V
+    double getHeatCapacity() const;           // Excess Cv per particle, beta^2 var(E) / N
+    double getCompressibilityFactor() const;  // Z = beta P / rho
+
+    const TimeSeries& getEnergyStat() const;
+    const TimeSeries& getVirialStat() const;
+    const TimeSeries& getPressureStat() const;
+    const TimeSeries& getSeries(Quantity quantity) const;
+    bool isConverged(Quantity quantity, double targetError) const;  // Equilibrated and standard error below target
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+};
+
+#endif // OBSERVABLES_H
@@ -0,0 +1,36 @@
+#ifndef QUANTISEDFRAME_H
+#define QUANTISEDFRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BoxSnapshot.h"
+
+// A frame with each coordinate stored as a 16-bit fixed-point fraction of the
+// box length: 6 bytes per particle instead of 24. A coordinate in [0, L)
+// decodes to the centre of its 1/65536 L bin, so it is within L / 131072 of
+// the original; good enough to look at, not to restart from.
+class QuantisedFrame {
+private:
+    int step;
+    double boxSize;
+    std::vector<uint16_t> coordinates;  // x, y, z per particle
+
+public:
+    static const int LEVELS = 65536;
+
+    QuantisedFrame();
+    void encode(const BoxSnapshot& snapshot);  // Reuses the existing storage
+    void assign(int frameStep, double frameBoxSize, const uint16_t* data, size_t count);
+    BoxSnapshot decode() const;
+    void clear();
+
+    int getStep() const;
+    double getBoxSize() const;
+    size_t getParticleCount() const;
+    const uint16_t* getCoordinates() const;
+    Particle getParticle(size_t index) const;
+    size_t getBytes() const;
+};
+
+#endif // QUANTISEDFRAME_H
@@ -0,0 +1,45 @@
+#ifndef RADIALDISTRIBUTION_H
+#define RADIALDISTRIBUTION_H
+
+#include <iosfwd>
+#include <vector>
+#include "Box.h"
+#include "CellList.h"
+
+// On-the-fly g(r) accumulator. Pairs are found through a cell list and binned
+// into one histogram per worker thread; the histograms are merged only when
+// g(r) is read out. A radius above a third of the box, including the default
+// half box, leaves a single cell, and the threads then split the particles.
+class RadialDistribution {
+private:
+    int numBins;
+    double maxRadius;       // 0 selects half the box length
+    double binWidth;
+    int sampleInterval;     // In sweeps of N moves
+    int numThreads;
+    long long samples;
+    double densitySum;      // Sum of N * rho over samples, for normalisation
+    CellList cells;
+    std::vector<std::vector<unsigned long long>> threadHistograms;
+
+    void accumulateCells(const Box& box, int thread);
+    void accumulatePairs(const Box& box, int thread);  // All pairs, when there is one cell
+
+public:
+    RadialDistribution(int bins = 100, double radius = 0.0, int interval = 1);
+    void reset();
+    void sample(const Box& box);
+
+    std::vector<float> getValues() const;  // Merged and normalised g(r) at the bin centres
+    long long getSampleCount() const;
+    double getBinWidth() const;
+    double getMaxRadius() const;
+    int getSampleInterval() const;
+    void setSampleInterval(int interval);
+
+    // The per-thread histograms are stored merged, so a checkpoint loads on any thread count
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+};
+
+#endif // RADIALDISTRIBUTION_H
@@ -2,7 +2,16 @@
 #define RENDERER_H
 
 #include "Box.h"
+#include "BoxSnapshot.h"
+#include "DirtyRanges.h"
+#include "QuantisedFrame.h"
 
+// Particles are drawn from a vertex buffer as shaded point sprites; the
+// buffer and shaders are created on first use in the current GL context
 void renderParticles(const Box& box);
+void renderParticles(const BoxSnapshot& frame);  // A frame from the history
+void renderParticles(const BoxSnapshot& frame, const DirtyRanges& changes);  // Live, changed since the last call in changes
+void renderParticles(const QuantisedFrame& frame);  // Decoded in the vertex shader
+void releaseRenderer();  // Before the GL context is destroyed
 
 #endif // RENDERER_H
@@ -2,30 +2,150 @@
 #define SIMULATION_H
 
 #include "Box.h"
+#include "Observables.h"
+#include "RadialDistribution.h"
+#include "StructureFactor.h"
+#include "SnapshotRing.h"
+#include "TrajectoryWriter.h"
+#include "MoveLog.h"
+#include <chrono>
+#include <iosfwd>
+#include <random>
+#include <sys/types.h>
 #include <vector>
-#include <deque>
 #include <string>
 
+// Outcome and timing of checkpoints. The pause is how long run() was held up;
+// the latency runs until the file was in place, which for a forked checkpoint
+// is when the child is reaped.
+struct CheckpointStats {
+    long long completed;
+    long long failed;
+    long long skipped;        // Forked checkpoints not started because every child slot was busy
+    int activeChildren;
+    double lastPauseMs;
+    double maxPauseMs;
+    double lastLatencyMs;
+    double maxLatencyMs;
+};
+
 class Simulation {
+public:
+    // When run() adds a frame to the history (and to an open trajectory)
+    enum SaveMode {
+        FIXED_INTERVAL,     // Every intervalSteps steps
+        DECORRELATION,      // Once per measured decorrelation time of the save quantity
+        OBSERVABLE_CHANGE   // Whenever the save quantity moved by the threshold since the last frame
+    };
+
 private:
     Box box;
     int numParticles;
     int numSteps;
     int intervalSteps;
     double beta;
-    std::deque<std::pair<int, std::vector<Particle>>> savedSteps;
+    unsigned int requestedSeed;  // 0 draws a new seed from the clock on every initialize()
+    unsigned int seed;           // Seed of the current run
+    int currentStep;
+    std::mt19937 rng;         // Owned rather than std::rand so its state can be checkpointed
+    double stepSize;          // Width of the uniform trial displacement along each axis
+    double energy;            // Running total energy, updated by the accepted move deltas
+    double virial;            // Running total virial, computed in the same pair loop as energy
+    double magnitudeScale;    // Largest |energy| or |virial| since the totals were last recomputed
+    Observables observables;
+    RadialDistribution radialDistribution;
+    StructureFactor structureFactor;
+    bool structureFactorEnabled;  // Costs O(number of k-vectors) per accepted move
+    Observables::Quantity stoppingQuantity;
+    double targetError;           // 0 disables the stopping rule
+    bool targetReached;
+    SnapshotRing savedSteps;
+    size_t historyFrames;     // Capacity of savedSteps in frames...
+    size_t historyBytes;      // ...or in bytes when non-zero
+    bool historyQuantised;    // Keep older history frames as 16-bit fixed point
+    SaveMode saveMode;
+    Observables::Quantity saveQuantity;
+    double saveThreshold;     // Change of saveQuantity per particle (pressure itself) for OBSERVABLE_CHANGE
+    int nextSaveStep;         // DECORRELATION: step of the next frame
+    double lastSavedValue;    // OBSERVABLE_CHANGE: saveQuantity at the last frame
+    TrajectoryWriter trajectoryWriter;
+    TrajectoryOptions trajectoryOptions;
+    int lastPersistedStep;    // Newest frame handed to the writer, -1 when none
+    MoveLog moveLog;
+    bool moveLogEnabled;      // Record accepted moves, saving full frames only as keyframes
+    int moveLogKeyframeInterval;
+    std::string checkpointFile;
+    int checkpointInterval;   // Steps between checkpoints, 0 for on request only
+    bool checkpointForking;   // Serialise in a forked child while this process keeps running
+    int maxCheckpointChildren;
+    std::vector<std::pair<pid_t, std::chrono::steady_clock::time_point>> checkpointChildren;
+    CheckpointStats checkpointStats;
+    int stateSyncInterval;    // Steps between syncs of the state file, 0 for only when it is closed
+
+    double uniform();         // In [0, 1)
+    void startRun();
+    double getInstantaneous(Observables::Quantity quantity) const;
+    bool isSaveDue() const;
+    void scheduleNextSave();  // After each frame added to the history
+    void streamMoveLog();     // To a writer that accepts moves
+    void endMoveLogStream();  // Writes the rest of the log and closes such a writer
+    void writeCheckpoint(std::ostream& out, const Box& configuration) const;
+    bool saveCheckpoint(const std::string& filename, const Box& configuration) const;
+    void recordCheckpoint(bool ok, double pauseMs, double latencyMs);
+    void reapCheckpointChildren(bool wait);
+    void commitState();       // Records the step and totals that go with the positions in the state file
 
 public:
     Simulation(int particles, int steps, double temperature, double box_size);
+    ~Simulation();  // Waits for forked checkpoints still being written
 
     // Initialization and execution
     void initialize();
+    bool initializeFromFile(const std::string& filename, long long frame = -1);  // Frame from 0, -1 for the last
     void step();                      // Perform a single simulation step
-    void run(int stepsToRun = 1);     // Run a specific number of steps
+    void run(int stepsToRun = 1);     // Run a specific number of steps, or until the stopping rule fires
+    void recomputeTotals();           // Resynchronise the running energy and virial with the box
 
     // Data saving and retrieval
-    void saveParticles(const std::string& filename) const;
-    const std::vector<Particle>& getCurrentParticles() const; // Get current particle states for rendering
+    void saveParticles(const std::string& filename);  // Writes unsaved frames, then streams new ones
+    void stopSaving();
+    const TrajectoryWriter& getTrajectoryWriter() const;
+    TrajectoryOptions& getTrajectoryOptions();  // Applied when saveParticles opens a new file
+    const BoxSnapshot& getLatestFrame() const;  // Most recently saved frame
+    BoxSnapshot getSnapshot();        // Current configuration, immutable and safe to hand to other threads
+    const SnapshotRing& getSavedSteps() const;
+    void setHistoryFrames(size_t frames);  // Takes effect on the next initialize()
+    void setHistoryBytes(size_t bytes);    // RAM budget for the history
+    void setHistoryQuantised(bool quantised);  // Takes effect on the next initialize()
+    bool isHistoryQuantised() const;
+    bool setHistorySpill(const std::string& directory);  // Frames beyond the budget go to disk there; empty disables
+
+    void setSaveMode(SaveMode mode, Observables::Quantity quantity = Observables::ENERGY, double threshold = 0.0);
+    SaveMode getSaveMode() const;
+    int getSaveInterval() const;      // Steps between frames DECORRELATION currently uses
+
+    // Move-log trajectory mode; saveParticles to a .mclog file writes the log, then streams it
+    void setMoveLogEnabled(bool enabled, int keyframeInterval = 1000);  // Starts a new log from the current state, or stops it
+    void setMoveLogMemoryLimit(size_t bytes);  // Oldest recorded steps are dropped beyond this
+    bool isMoveLogEnabled() const;
+    const MoveLog& getMoveLog() const;
+
+    // Checkpoint and restart. A restored run continues exactly as the original would have.
+    bool saveCheckpoint(const std::string& filename) const;  // Atomic: written to a temporary file, then renamed
+    bool loadCheckpoint(const std::string& filename);         // Leaves the simulation untouched on failure
+    void setCheckpoint(const std::string& filename, int interval);  // Used by run() on the interval and on SIGUSR1
+    bool checkpoint();                                        // Checkpoint to that file now, forked if enabled
+    void setCheckpointForking(bool enabled, int maxChildren = 1);
+    bool isCheckpointForking() const;
+    const CheckpointStats& getCheckpointStats() const;
+    static void installCheckpointSignalHandler();             // SIGUSR1 requests a checkpoint at the next step
+
+    // Live particle state in a memory-mapped file (.mcstate) that survives a crash and that other
+    // processes can attach to read-only. Restoring maps the file instead of reading it, and continues
+    // the chain from the stored positions, step and totals with a new random stream and fresh averages.
+    bool setStateFile(const std::string& filename, int syncInterval);  // Empty filename returns to memory
+    bool restoreStateFile(const std::string& filename, int syncInterval);
+    bool hasStateFile();
 
     // Parameter setters and getters
     void setIntervalSteps(int interval);
@@ -35,6 +155,22 @@ public:
     void setNumSteps(int steps);
     double getTemperature() const;
     void setTemperature(double temp);
+    unsigned int getSeed() const;
+    void setSeed(unsigned int value);
+    double getStepSize() const;
+    void setStepSize(double size);
+
+    // Thermodynamic observables
+    int getCurrentStep() const;
+    double getEnergy() const;
+    double getVirial() const;
+    const Observables& getObservables() const;
+    void setStoppingRule(Observables::Quantity quantity, double standardError);
+    bool hasReachedTarget() const;
+    const RadialDistribution& getRadialDistribution() const;
+    const StructureFactor& getStructureFactor() const;
+    void setStructureFactorEnabled(bool enabled);
+    bool isStructureFactorEnabled() const;
 
     // Access to the simulation box
     Box& getBox();
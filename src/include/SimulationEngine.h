@@ -0,0 +1,130 @@
+#ifndef SIMULATIONENGINE_H
+#define SIMULATIONENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "BoxSnapshot.h"
+#include "DirtyRanges.h"
+#include "QuantisedFrame.h"
+#include "Simulation.h"
+#include "SpscQueue.h"
+#include "TripleBuffer.h"
+
+// Everything the UI shows of the simulation, as of one moment on the engine thread
+struct EngineFrame {
+    uint64_t commandsDone;        // Commands executed before this frame, compare with post()'s ticket
+    bool running;
+    double stepsPerSecond;
+
+    BoxSnapshot live;
+    DirtyRanges liveChanges;      // Particles changed since the last frame the UI took
+    int historyIndex;             // Frame selected with showHistoryFrame(), -1 for none
+    int historyStep;
+    BoxSnapshot history;          // The selected frame, unless the history is quantised...
+    std::shared_ptr<const QuantisedFrame> historyQuantised;  // ...in which case it is kept so
+    size_t historySize;
+    bool historySpilling;
+    size_t spilledFrames;
+    uint64_t spilledBytes;
+
+    int step;
+    int numParticles;
+    int numSteps;
+    double temperature;
+    double boxSize;
+    double energyPerParticle;
+    double pressure;
+    double pressureError;
+    double heatCapacity;
+    double compressibility;
+    bool equilibrated;
+    long long burnIn;
+    double autocorrelationTime;
+    bool targetReached;
+    int saveInterval;
+
+    std::vector<float> gofr;
+    double rdfMaxRadius;
+    long long rdfSamples;
+    bool structureFactorEnabled;
+    std::vector<float> kValues;
+    std::vector<float> sofk;
+
+    bool writerOpen;
+    std::string writerFilename;
+    long long writtenFrames;
+    long long droppedFrames;
+    bool moveLogEnabled;
+    int moveLogFirstStep;
+    int moveLogLastStep;
+    size_t moveLogEvents;
+    size_t moveLogKeyframes;
+    size_t moveLogBytes;
+    bool checkpointForking;
+    CheckpointStats checkpoints;
+    bool stateFile;
+};
+
+// Runs a Simulation on its own thread, as fast as it goes, while the UI thread
+// renders at the display rate. The UI changes the simulation only through
+// commands, which the engine executes between batches of steps, and sees it
+// only through EngineFrames, published through a triple buffer at most
+// PUBLISH_HZ times a second. Neither thread ever waits for the other; the
+// engine sleeps only while paused with no commands queued. A run pauses by
+// itself at its number of steps or when the stopping rule fires.
+class SimulationEngine {
+public:
+    typedef std::function<void(Simulation&)> Command;
+    static const int PUBLISH_HZ = 120;
+    static const size_t COMMAND_CAPACITY = 256;
+
+private:
+    Simulation& simulation;
+    SpscQueue<Command> commands;      // UI -> engine
+    TripleBuffer<EngineFrame> frames; // Engine -> UI
+    uint64_t posted;                  // UI thread only
+    std::thread worker;
+    std::mutex idleMutex;
+    std::condition_variable wake;
+    std::atomic<bool> stopping;
+
+    // Engine thread only
+    uint64_t executed;
+    bool running;
+    int stepsPerBatch;
+    double stepsPerSecond;
+    int historyIndex;
+    int historyStep;
+    BoxSnapshot historyFrame;
+    std::shared_ptr<const QuantisedFrame> historyQuantised;
+    DirtyRanges unseenChanges;        // In frames the UI may not have taken
+
+    void loop();
+    bool executeCommands();
+    void runBatch();
+    void publish();
+    void fetchHistoryFrame();
+
+    SimulationEngine(const SimulationEngine&);
+    SimulationEngine& operator=(const SimulationEngine&);
+
+public:
+    explicit SimulationEngine(Simulation& target);  // The engine thread owns target from here on
+    ~SimulationEngine();
+
+    // UI thread
+    uint64_t post(const Command& command);  // Ticket: done once getFrame().commandsDone reaches it
+    uint64_t setRunning(bool run);
+    uint64_t showHistoryFrame(int index);   // -1 for none
+    bool update();                          // Takes the newest frame, false if there is none since the last
+    const EngineFrame& getFrame() const;
+};
+
+#endif // SIMULATIONENGINE_H
@@ -0,0 +1,96 @@
+#ifndef SNAPSHOTRING_H
+#define SNAPSHOTRING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Particle.h"
+#include "BoxSnapshot.h"
+#include "HistorySpill.h"
+#include "QuantisedFrame.h"
+
+// Non-owning view of one saved frame
+struct Frame {
+    int step;
+    const Particle* particles;
+    size_t count;
+    const uint32_t* ids;  // Index in the box of each particle, or nullptr when the frame holds all of them in order
+
+    Frame() : step(0), particles(nullptr), count(0), ids(nullptr) {}
+};
+
+// Frames of a history handed to another thread, which reads them while the
+// history moves on: frames in memory are held as snapshots sharing their
+// chunks, spilled ones by their place in the spill file and read from disk
+// by getFrame().
+class HistoryBacklog {
+private:
+    struct Item {
+        BoxSnapshot snapshot;
+        SpilledFrame spilled;
+        bool isSpilled;
+    };
+    std::vector<Item> items;
+    std::shared_ptr<SpillReader> reader;
+    mutable std::vector<Particle> buffer;
+
+public:
+    void add(const BoxSnapshot& snapshot);
+    void addSpilled(const SpilledFrame& frame, const std::shared_ptr<SpillReader>& spillReader);
+    size_t size() const;
+    int getStep(size_t index) const;
+    bool getFrame(size_t index, BoxSnapshot& frame) const;  // False if a spilled frame cannot be read
+};
+
+// History of frames. The newest frames are kept in memory in a fixed number
+// of slots (the RAM budget), overwriting the oldest once full. Each slot holds
+// a BoxSnapshot, so consecutive frames share the chunks that did not change
+// between them and saving a frame copies only modified chunks.
+//
+// A quantised history stores the slots as QuantisedFrames instead, four
+// times as many for the same budget; only the newest frame is also kept at
+// full precision, and older frames read back carry the quantisation error.
+//
+// With a spill directory set, a frame leaving memory is appended to a
+// HistorySpill on disk instead of being dropped, and reading it pages it back
+// in; the history is then limited by disk space rather than RAM. Frames are
+// numbered from the oldest, spilled ones first.
+class SnapshotRing {
+private:
+    std::vector<BoxSnapshot> slots;
+    std::vector<QuantisedFrame> quantisedSlots;  // Used instead of slots when quantised
+    BoxSnapshot newest;
+    bool quantised;
+    size_t particlesPerFrame;
+    size_t capacity;
+    size_t head;                   // Slot the next frame is written to
+    size_t count;                  // Frames in memory
+    HistorySpill spill;
+
+    size_t getSlot(size_t index) const;  // Slot of the index'th oldest frame in memory
+
+public:
+    SnapshotRing();
+    void configure(size_t particles, size_t frames, bool quantise = false);
+    void configureBytes(size_t particles, size_t bytes, bool quantise = false);  // Frames that fit even if none share chunks, at least one
+    bool setSpillDirectory(const std::string& directory);  // Empty disables spilling and drops the spilled frames
+    void push(const BoxSnapshot& snapshot);
+    void clear();
+
+    size_t size() const;                 // All frames, in memory and spilled
+    size_t getCapacity() const;          // Frames held in memory
+    size_t getParticlesPerFrame() const;
+    bool isQuantised() const;
+    bool isSpilling() const;
+    size_t getSpilledFrames() const;
+    uint64_t getSpilledBytes() const;
+    BoxSnapshot getFrame(size_t index) const;  // 0 is the oldest frame held; reads spilled frames from disk
+    void getQuantisedFrame(size_t index, QuantisedFrame& frame) const;  // Without decoding, when stored quantised
+    int getStep(size_t index) const;           // Without reading the frame
+    void getFramesAfter(int step, HistoryBacklog& backlog) const;  // Full-precision frames, without reading any
+    const BoxSnapshot& back() const;           // Always at full precision
+};
+
+#endif // SNAPSHOTRING_H
@@ -0,0 +1,98 @@
+#ifndef STATEFILE_H
+#define STATEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Particle.h"
+
+// File layout (.mcstate, host byte order): a 4096-byte page holding the
+// StateFileHeader, then room for `capacity` particles of 3 doubles each.
+// The particle count and positions are the live values, and the header also
+// records the step, totals and run parameters that go with them.
+struct StateFileHeader {
+    char magic[8];          // "MCSMSTAT"
+    uint32_t version;
+    uint32_t closedCleanly; // Set by close() after the final sync
+    uint64_t sequence;      // Odd while the owner is between commits
+    uint64_t particleCount;
+    uint64_t capacity;
+    double boxSize;
+    int64_t step;
+    double energy;
+    double virial;
+    double beta;
+    double stepSize;
+    int64_t syncedStep;     // Step of the last sync(), -1 before the first
+    char bootId[40];        // Boot of the system that last wrote the file
+};
+
+// Particle positions kept in a shared memory mapping of a file, so they
+// outlive the process that writes them. Once the owner has written a value it
+// is in the page cache: a crash of the process loses nothing, and sync()
+// bounds what a crash of the machine can lose. Other processes attach()
+// read-only and see the same pages, without a copy.
+//
+// The owner opens an update with beginUpdate() before changing positions and
+// closes it with commit(), which stores the matching step and totals. The
+// header sequence is odd in between, so a reader can tell whether what it
+// read is a consistent configuration.
+class StateFile {
+public:
+    static const uint64_t DATA_OFFSET = 4096;
+
+private:
+    int fd;
+    char* data;
+    uint64_t mappedBytes;
+    bool writable;
+    bool consistent;        // Evaluated when the file was opened
+
+    StateFileHeader* header();
+    const StateFileHeader* header() const;
+    bool map(uint64_t bytes);
+
+    StateFile(const StateFile&);
+    StateFile& operator=(const StateFile&);
+
+public:
+    StateFile();
+    ~StateFile();
+    bool create(const std::string& filename, size_t capacity);  // Replaces any existing file
+    bool open(const std::string& filename);                     // Existing file, for writing
+    bool attach(const std::string& filename);                   // Existing file, read-only
+    void close();  // Syncs and marks the file closed cleanly when writable
+    bool isOpen() const;
+    bool isWritable() const;
+
+    // Owner side
+    bool reserve(size_t particles);  // Grows the file; the particle array may move
+    void resize(size_t particles);   // Within the reserved capacity
+    void setBoxSize(double size);
+    void beginUpdate();
+    void commit(int step, double energy, double virial, double beta, double stepSize);
+    bool sync();  // Positions and header on disk, up to the last commit
+    Particle* getParticles();
+
+    // Either side
+    const Particle* getParticles() const;
+    size_t getParticleCount() const;  // Clamped to the mapped capacity of an attached reader
+    size_t getCapacity() const;
+    double getBoxSize() const;
+    int getStep() const;
+    double getEnergy() const;
+    double getVirial() const;
+    double getBeta() const;
+    double getStepSize() const;
+    int getSyncedStep() const;
+    uint64_t getSequence() const;
+    bool isConsistent() const;    // When opened, the positions matched the recorded step and totals
+    uint64_t getBytes() const;
+
+    // Reader side: copies the configuration between two commits, retrying up to
+    // `attempts` times while the owner is updating it
+    bool readConfiguration(std::vector<Particle>& particles, int& step, double& boxSize, int attempts = 100) const;
+};
+
+#endif // STATEFILE_H
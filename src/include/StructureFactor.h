@@ -0,0 +1,54 @@
+#ifndef STRUCTUREFACTOR_H
+#define STRUCTUREFACTOR_H
+
+#include <iosfwd>
+#include <vector>
+#include "Box.h"
+
+// Static structure factor S(k) = <|rho(k)|^2> / N over the reciprocal lattice
+// k = 2 pi n / L with |n| <= maxIndex. The collective densities rho(k) are
+// kept up to date move by move, since a single-particle move changes only
+// one term of each sum; a full recomputation is needed only on initialize.
+class StructureFactor {
+private:
+    int maxIndex;
+    int sampleInterval;     // In sweeps of N moves
+    double boxSize;
+    size_t numParticles;
+    long long samples;
+
+    // Half of the lattice (S(k) = S(-k)), one entry per k-vector
+    std::vector<int> nx, ny, nz;
+    std::vector<int> shellOf;          // Index into the |n|^2 shells
+    std::vector<double> rhoRe, rhoIm;  // Current sum of exp(i k.r)
+    std::vector<double> sumS;          // Accumulated |rho|^2 / N
+
+    std::vector<int> shellNorm2;       // Distinct |n|^2 values, ascending
+    std::vector<int> shellCount;
+
+    // Positions in structure-of-arrays layout for the full recomputation
+    std::vector<double> xs, ys, zs;
+    std::vector<double> moveScratch;   // Old and new phases of a moved particle
+
+    void buildLattice();
+    void computeRange(size_t firstK, size_t lastK);
+    void axisPhases(double coordinate, double* re, double* im) const;
+
+public:
+    StructureFactor(int maxIndex = 5, int interval = 1);
+    void initialize(const Box& box);  // Builds the k-vectors and recomputes rho(k) from scratch
+    void particleMoved(const Particle& oldPosition, const Particle& newPosition);
+    void sample();
+
+    // Shell-averaged S(k) against |k|
+    void getValues(std::vector<float>& k, std::vector<float>& s) const;
+    long long getSampleCount() const;
+    int getSampleInterval() const;
+    void setSampleInterval(int interval);
+
+    // rho(k) is stored as accumulated, not recomputed, so a restart continues bit for bit
+    void save(std::ostream& out) const;
+    bool load(std::istream& in, const Box& box);
+};
+
+#endif // STRUCTUREFACTOR_H
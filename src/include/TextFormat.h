@@ -0,0 +1,20 @@
+#ifndef TEXTFORMAT_H
+#define TEXTFORMAT_H
+
+// Locale-independent number formatting into caller-provided buffers. Each
+// formatting function writes at most 32 characters and returns the end of the output.
+
+// Same text as printf("%.<precision>g") (and std::ostream with that
+// precision) for precision 1..15; precision 0 selects the shortest form of
+// up to 15 significant digits that reads back exactly, else 17 digits.
+char* formatGeneral(char* out, double value, int precision);
+
+char* formatInteger(char* out, long long value);
+
+// Parses a decimal number at p, after any blanks, without reading past end.
+// Returns the position after the number, or nullptr if there is none. The
+// result is correctly rounded: up to 19 significant digits with a decimal
+// exponent within +-22 take an exact fast path, anything else goes to strtod.
+const char* parseDouble(const char* p, const char* end, double& value);
+
+#endif // TEXTFORMAT_H
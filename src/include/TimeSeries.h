@@ -0,0 +1,73 @@
+#ifndef TIMESERIES_H
+#define TIMESERIES_H
+
+#include <iosfwd>
+#include <vector>
+
+// Streaming mean and variance (Welford), numerically stable for long runs
+class RunningStat {
+private:
+    long long n;
+    double mean;
+    double m2;
+
+public:
+    RunningStat();
+    void add(double value);
+    void reset();
+    long long getCount() const;
+    double getMean() const;
+    double getVariance() const;       // Sample variance
+    double getStandardError() const;  // Assumes uncorrelated samples
+
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+};
+
+// Streaming analysis of one correlated observable:
+//  - hierarchical (Flyvbjerg-Petersen) blocking for the autocorrelation time
+//  - a bounded store of coarse block means for MSER equilibration detection,
+//    from which the reported mean and standard error exclude the burn-in
+// Memory stays bounded no matter how many samples are added.
+class TimeSeries {
+private:
+    static const int MAX_BLOCKS = 128;
+
+    // Blocking levels; level l holds means of 2^l consecutive samples
+    std::vector<RunningStat> levels;
+    std::vector<double> pending;
+    std::vector<bool> hasPending;
+
+    // Coarse block means covering the whole run; pairs merge when full
+    std::vector<double> blockMeans;
+    long long blockSize;
+    double partialSum;
+    long long partialCount;
+
+    long long totalSamples;
+    long long fineStart;  // Sample at which the blocking levels were last restarted
+    int truncation;       // MSER burn-in, in coarse blocks
+    bool equilibrated;
+
+    void addBlock(double mean);
+    void detectEquilibration();
+
+public:
+    TimeSeries();
+    void add(double value);
+    void reset();
+
+    long long getCount() const;
+    long long getBurnIn() const;       // Samples discarded as burn-in
+    bool isEquilibrated() const;
+    double getMean() const;            // After the burn-in
+    double getVariance() const;        // Of individual samples since the blocking levels restarted
+    double getStandardError() const;   // Accounts for correlation between samples
+    double getAutocorrelationTime() const;  // Integrated, in samples
+
+    // Exact accumulator state, for checkpoints
+    void save(std::ostream& out) const;
+    bool load(std::istream& in);
+};
+
+#endif // TIMESERIES_H
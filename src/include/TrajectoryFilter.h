@@ -0,0 +1,53 @@
+#ifndef TRAJECTORYFILTER_H
+#define TRAJECTORYFILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "BoxSnapshot.h"
+
+// Selects the particles of each frame that are written out. A particle is
+// kept when it passes every enabled criterion:
+//  - its index lies in one of indexRanges (half-open, none means all)
+//  - its index is a multiple of stride
+//  - its species in the type table is one of keepTypes
+//  - its position lies in the region [regionLow, regionHigh) on every axis
+// The index criteria do not depend on positions, so they are resolved into
+// an index list once per particle count and each frame only gathers those
+// particles and tests the region.
+class TrajectoryFilter {
+private:
+    std::vector<std::pair<size_t, size_t>> indexRanges;
+    size_t stride;
+    std::vector<int> types;      // Species of each particle index; missing entries are species 1
+    std::vector<int> keepTypes;  // Empty keeps every species
+    bool regionEnabled;
+    double regionLow[3];
+    double regionHigh[3];
+
+    std::vector<uint32_t> candidates;  // Indices passing the index criteria
+    size_t candidateCount;             // Particle count candidates was built for
+    bool candidatesStale;
+
+    bool selectsIndices() const;
+    bool keepsIndex(size_t index) const;
+
+public:
+    TrajectoryFilter();
+    void addIndexRange(size_t begin, size_t end);
+    void setStride(size_t every);
+    void setTypes(const std::vector<int>& particleTypes);
+    bool loadTypes(const std::string& filename);  // One species number per particle, whitespace separated
+    void setKeptTypes(const std::vector<int>& kept);
+    void setRegion(const double low[3], const double high[3]);
+    void clear();
+    bool isActive() const;
+    bool hasRegion() const;  // The kept particle count then varies from frame to frame
+
+    // Gathers the kept particles of snapshot and their indices
+    void apply(const BoxSnapshot& snapshot, std::vector<Particle>& particles, std::vector<uint32_t>& ids);
+};
+
+#endif // TRAJECTORYFILTER_H
@@ -0,0 +1,72 @@
+#ifndef TRAJECTORYSINK_H
+#define TRAJECTORYSINK_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "AsyncFile.h"
+#include "SnapshotRing.h"
+#include "TrajectoryFilter.h"
+
+struct MoveEvent;
+
+// Destination format for streamed frames. All calls come from the writer thread.
+// A filtered frame carries the box index of each particle in Frame::ids;
+// the LAMMPS dump writes them as atom ids, the binary formats do not store
+// ids and need the same particle count in every frame. A move log also takes
+// the accepted moves between its frames, which are then keyframes.
+class TrajectorySink {
+public:
+    virtual ~TrajectorySink() {}
+    virtual bool open(const std::string& filename, double boxSize) = 0;
+    virtual bool write(const Frame& frame) = 0;  // False if the frame was not written
+    virtual bool writeMoves(const MoveEvent*, size_t, int) { return false; }  // Moves up to a step
+    virtual bool acceptsMoves() const { return false; }
+    virtual bool hasFixedParticleCount() const { return false; }  // Frames must all have the first one's count
+    virtual void flush() = 0;
+    virtual void close() = 0;
+};
+
+// LAMMPS text dump, appended to by default like the original saveParticles
+// output and byte-identical to it at the default precision of 6. Large frames
+// are formatted in parallel chunks into reusable buffers and handed to an
+// AsyncFile, so the next frame is formatted while this one is written.
+class LammpsDumpSink : public TrajectorySink {
+private:
+    AsyncFile file;
+    double boxSize;
+    bool append;
+    int precision;   // Significant digits, 0 for shortest round trip
+    int numThreads;
+    std::vector<char> headerBuffer;
+    std::vector<std::vector<char>> chunkBuffers;
+
+    size_t formatChunk(const Frame& frame, size_t begin, size_t end, std::vector<char>& buffer) const;
+
+public:
+    explicit LammpsDumpSink(bool appendToFile = true, int textPrecision = 6);
+    ~LammpsDumpSink();
+    bool open(const std::string& filename, double size) override;
+    bool write(const Frame& frame) override;
+    void flush() override;
+    void close() override;
+};
+
+// Settings forwarded to whichever format a filename selects
+struct TrajectoryOptions {
+    uint64_t seed;
+    double compressionPrecision;  // .mcz quantisation step relative to the box length
+    int keyframeInterval;         // .mcz frames between keyframes
+    int textPrecision;            // LAMMPS dump significant digits, 0 for shortest round trip
+    TrajectoryFilter filter;      // Particles written, selected on the writer thread before formatting
+
+    TrajectoryOptions() : seed(0), compressionPrecision(1e-4), keyframeInterval(100), textPrecision(6) {}
+};
+
+// Picks the format from the extension: ".mctraj" is the binary trajectory,
+// ".mcz" the compressed trajectory, ".mclog" a move log, anything else a
+// LAMMPS dump. Every format replaces an existing file, so writing the same
+// history twice cannot leave duplicate frames.
+TrajectorySink* createTrajectorySink(const std::string& filename, const TrajectoryOptions& options);
+
+#endif // TRAJECTORYSINK_H
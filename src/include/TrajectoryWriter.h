@@ -0,0 +1,84 @@
+#ifndef TRAJECTORYWRITER_H
+#define TRAJECTORYWRITER_H
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "MoveLog.h"
+#include "SnapshotRing.h"
+#include "SpscQueue.h"
+#include "TrajectorySink.h"
+
+// Streams frames to a TrajectorySink on a dedicated thread. The producer
+// stores a reference to each snapshot's chunks in a slot and hands the slot
+// over through a lock-free queue; the writer thread assembles the contiguous
+// frame, so no particle data is copied on the simulation thread. submit()
+// drops the frame if every slot is still waiting. A backlog of history
+// frames is handed over whole instead and never dropped; the writer thread
+// writes it after the frames submitted before it and before those submitted
+// after, paging spilled frames in itself. Move log segments are handed
+// over the same way, for sinks that accept moves. An output
+// filter is applied there too, gathering only the kept particles, so the
+// formatting and I/O scale with what is written.
+class TrajectoryWriter {
+private:
+    // A backlog goes out once the writer has taken `position` frames from the
+    // queue; it holds history frames or move log segments
+    struct Backlog {
+        long long position;
+        std::shared_ptr<const HistoryBacklog> frames;
+        std::shared_ptr<const std::vector<MoveLogSegment>> moves;
+    };
+
+    std::unique_ptr<TrajectorySink> sink;
+    std::string filename;
+    std::thread worker;
+    std::atomic<bool> stopRequested;
+
+    std::vector<BoxSnapshot> slots;
+    std::vector<Particle> frameBuffer;  // Writer thread only
+    std::vector<uint32_t> frameIds;
+    TrajectoryFilter filter;
+    SpscQueue<size_t> filled;      // Producer -> writer
+    SpscQueue<size_t> available;   // Writer -> producer
+    long long queuedFrames;        // Pushed to filled, producer only
+    long long takenFrames;         // Popped from filled, writer only
+    std::mutex backlogMutex;
+    std::deque<Backlog> backlogs;
+    size_t backlogFrame;           // Next frame or segment of backlogs.front(), writer only
+
+    std::atomic<long long> writtenFrames;
+    std::atomic<long long> droppedFrames;
+
+    void writeFrame(const BoxSnapshot& snapshot);
+    void writeSegment(const MoveLogSegment& segment);
+    bool writeBacklogFrame();  // False when no backlog is due
+    void writeLoop();
+
+public:
+    explicit TrajectoryWriter(size_t queueFrames = 64);
+    ~TrajectoryWriter();
+
+    // Takes ownership of format; a LAMMPS dump is used when none is given. Frames
+    // the sink rejects count as dropped, and a region filter, which changes the
+    // particle count, is refused for sinks that need a fixed one; any filter is
+    // refused for sinks that accept moves, which record every particle.
+    bool open(const std::string& path, double boxSize, TrajectorySink* format = nullptr,
+              const TrajectoryFilter& outputFilter = TrajectoryFilter());
+    void close();   // Writes everything still queued, then stops the thread
+    bool isOpen() const;
+    const std::string& getFilename() const;
+    bool acceptsMoves() const;  // The open sink records move log segments rather than frames
+
+    bool submit(const BoxSnapshot& snapshot);  // False if the frame was not queued
+    bool submit(const std::shared_ptr<const HistoryBacklog>& backlog);  // False only without an open file
+    bool submit(const std::shared_ptr<const std::vector<MoveLogSegment>>& segments);  // Also false unless acceptsMoves()
+    long long getWrittenFrames() const;
+    long long getDroppedFrames() const;
+};
+
+#endif // TRAJECTORYWRITER_H
@@ -0,0 +1,53 @@
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+// Latest-value channel between one producer thread and one consumer thread.
+// Each side owns one of three slots and the third is parked in the middle;
+// publishing and reading swap a slot with the middle one, so neither side
+// ever waits for the other, and the reader always gets the newest complete
+// value. Values published between two reads are skipped.
+template <typename T>
+class TripleBuffer {
+private:
+    static const unsigned FRESH = 4;  // Set on the middle index when it holds an unread value
+
+    T slots[3];
+    unsigned back;                    // Producer's slot
+    unsigned front;                   // Consumer's slot
+    alignas(64) std::atomic<unsigned> middle;
+
+    TripleBuffer(const TripleBuffer&);
+    TripleBuffer& operator=(const TripleBuffer&);
+
+public:
+    TripleBuffer() : back(0), front(1), middle(2) {}
+
+    // Producer: fill the slot returned by getBack(), then publish() it
+    T& getBack() {
+        return slots[back];
+    }
+
+    // False if the previously published value was never read and has now been skipped
+    bool publish() {
+        unsigned previous = middle.exchange(back | FRESH, std::memory_order_acq_rel);
+        back = previous & ~FRESH;
+        return (previous & FRESH) == 0;
+    }
+
+    // Consumer: takes the newest published value if there is one; false if it is the one already held
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+        return true;
+    }
+
+    const T& getFront() const {
+        return slots[front];
+    }
+};
+
+#endif // TRIPLEBUFFER_H
@@ -0,0 +1,454 @@
+#include "AsyncFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+namespace {
+const size_t BUFFER_ALIGNMENT = 4096;
+}
+
+const size_t AsyncFile::BUFFER_BYTES;
+const size_t AsyncFile::BUFFER_COUNT;
+AsyncFile::Backend AsyncFile::defaultBackend = AsyncFile::AUTO;
+
+#ifdef HAVE_IO_URING
+struct AsyncFile::Ring {
+    int fd;
+    void* sqMapping;
+    size_t sqMappingBytes;
+    void* cqMapping;              // Same as sqMapping with IORING_FEAT_SINGLE_MMAP
+    size_t cqMappingBytes;
+    io_uring_sqe* sqes;
+    size_t sqesBytes;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    io_uring_cqe* cqes;
+};
+
+namespace {
+int ringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ringEnter(int fd, unsigned submit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, minComplete, flags, nullptr, 0));
+}
+
+int ringRegister(int fd, unsigned opcode, const void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, count));
+}
+}
+
+bool AsyncFile::setupRing() {
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+    int ringFd = ringSetup(BUFFER_COUNT, &params);
+    if (ringFd < 0) {
+        return false;
+    }
+    ring.reset(new Ring());
+    Ring& r = *ring;
+    r.fd = ringFd;
+    r.sqMappingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    r.cqMappingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        r.sqMappingBytes = r.cqMappingBytes = std::max(r.sqMappingBytes, r.cqMappingBytes);
+    }
+    r.sqMapping = mmap(nullptr, r.sqMappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                       IORING_OFF_SQ_RING);
+    r.cqMapping = single || r.sqMapping == MAP_FAILED
+                      ? r.sqMapping
+                      : mmap(nullptr, r.cqMappingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+                             IORING_OFF_CQ_RING);
+    r.sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, r.sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+    r.sqes = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe*>(sqes);
+    if (r.sqMapping == MAP_FAILED || r.cqMapping == MAP_FAILED || r.sqes == nullptr) {
+        closeRing();
+        return false;
+    }
+
+    char* sq = static_cast<char*>(r.sqMapping);
+    char* cq = static_cast<char*>(r.cqMapping);
+    r.sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    r.sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    r.sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    r.sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    r.cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    r.cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    r.cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    r.cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    // Registered buffers are pinned once instead of on every write
+    std::vector<iovec> vectors(buffers.size());
+    for (size_t b = 0; b < buffers.size(); b++) {
+        vectors[b].iov_base = buffers[b];
+        vectors[b].iov_len = BUFFER_BYTES;
+    }
+    if (ringRegister(ringFd, IORING_REGISTER_BUFFERS, vectors.data(), static_cast<unsigned>(vectors.size())) != 0) {
+        closeRing();
+        return false;
+    }
+    return true;
+}
+
+void AsyncFile::closeRing() {
+    if (!ring) {
+        return;
+    }
+    Ring& r = *ring;
+    if (r.sqes != nullptr) {
+        munmap(r.sqes, r.sqesBytes);
+    }
+    if (r.cqMapping != MAP_FAILED && r.cqMapping != r.sqMapping) {
+        munmap(r.cqMapping, r.cqMappingBytes);
+    }
+    if (r.sqMapping != MAP_FAILED) {
+        munmap(r.sqMapping, r.sqMappingBytes);
+    }
+    ::close(r.fd);
+    ring.reset();
+}
+
+// One buffer is in flight at most once, so the BUFFER_COUNT submission slots never run out
+void AsyncFile::pushRingWrite(size_t buffer) {
+    Ring& r = *ring;
+    const Write& pending = writes[buffer];
+    unsigned tail = *r.sqTail;
+    unsigned index = tail & r.sqMask;
+    io_uring_sqe& sqe = r.sqes[index];
+    std::memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITE_FIXED;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(buffers[buffer] + pending.done);
+    sqe.len = static_cast<uint32_t>(fill[buffer] - pending.done);
+    sqe.off = pending.offset + pending.done;
+    sqe.buf_index = static_cast<uint16_t>(buffer);
+    sqe.user_data = buffer;
+    r.sqArray[index] = index;
+    __atomic_store_n(r.sqTail, tail + 1, __ATOMIC_RELEASE);
+    int submitted;
+    while ((submitted = ringEnter(r.fd, 1, 0, 0)) < 0 && errno == EINTR) {
+    }
+    if (submitted < 0) {
+        std::cerr << "Error submitting write: " << std::strerror(errno) << std::endl;
+        failed = true;
+        // The kernel only reads the tail inside io_uring_enter, so an entry it
+        // has not consumed is withdrawn here; otherwise the next enter would
+        // submit it after the buffer had been refilled. A consumed entry keeps
+        // the buffer busy until its completion is reaped.
+        if (__atomic_load_n(r.sqHead, __ATOMIC_ACQUIRE) == tail) {
+            __atomic_store_n(r.sqTail, tail, __ATOMIC_RELEASE);
+            busy[buffer] = 0;
+            inFlight--;
+        }
+    }
+}
+
+void AsyncFile::reap(bool wait) {
+    if (!ring) {
+        return;
+    }
+    Ring& r = *ring;
+    unsigned head = *r.cqHead;
+    if (wait && head == __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE)) {
+        while (ringEnter(r.fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno == EINTR) {
+        }
+    }
+    unsigned tail = __atomic_load_n(r.cqTail, __ATOMIC_ACQUIRE);
+    std::vector<size_t> resubmit;
+    for (; head != tail; head++) {
+        const io_uring_cqe& cqe = r.cqes[head & r.cqMask];
+        size_t buffer = static_cast<size_t>(cqe.user_data);
+        Write& pending = writes[buffer];
+        if (cqe.res <= 0) {
+            std::cerr << "Error writing file: " << std::strerror(cqe.res < 0 ? -cqe.res : ENOSPC) << std::endl;
+            failed = true;
+        } else if (pending.done + cqe.res < fill[buffer]) {
+            pending.done += cqe.res;  // Short write: send the rest
+            resubmit.push_back(buffer);
+            continue;
+        }
+        busy[buffer] = 0;
+        inFlight--;
+    }
+    __atomic_store_n(r.cqHead, head, __ATOMIC_RELEASE);
+    for (size_t i = 0; i < resubmit.size(); i++) {
+        pushRingWrite(resubmit[i]);
+    }
+}
+#else
+struct AsyncFile::Ring {};
+
+bool AsyncFile::setupRing() {
+    return false;
+}
+
+void AsyncFile::closeRing() {
+}
+
+void AsyncFile::pushRingWrite(size_t) {
+}
+
+void AsyncFile::reap(bool) {
+}
+#endif
+
+AsyncFile::AsyncFile()
+    : fd(-1), backend(AUTO), current(0), offset(0), inFlight(0), failed(false), stopping(false) {}
+
+AsyncFile::~AsyncFile() {
+    close();
+    for (size_t b = 0; b < buffers.size(); b++) {
+        std::free(buffers[b]);
+    }
+}
+
+bool AsyncFile::open(const std::string& filename, bool append, Backend requested) {
+    close();
+    if (buffers.empty()) {
+        for (size_t b = 0; b < BUFFER_COUNT; b++) {
+            void* memory = nullptr;
+            if (posix_memalign(&memory, BUFFER_ALIGNMENT, BUFFER_BYTES) != 0) {
+                std::cerr << "Error allocating write buffers" << std::endl;
+                return false;
+            }
+            buffers.push_back(static_cast<char*>(memory));
+        }
+        fill.assign(BUFFER_COUNT, 0);
+        writes.resize(BUFFER_COUNT);
+        busy.assign(BUFFER_COUNT, 0);
+    }
+
+    // Not O_APPEND: each write carries its own offset, and O_APPEND would make
+    // the kernel ignore it and reorder buffers completing out of order
+    fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    off_t end = append ? lseek(fd, 0, SEEK_END) : 0;
+    offset = end > 0 ? static_cast<uint64_t>(end) : 0;
+    current = 0;
+    std::fill(fill.begin(), fill.end(), 0);
+    failed = false;
+
+    if (requested == AUTO) {
+        requested = defaultBackend;
+    }
+    backend = PWRITE_THREAD;
+    if (requested != PWRITE_THREAD && setupRing()) {
+        backend = IO_URING;
+    } else {
+        if (requested == IO_URING) {
+            std::cerr << "io_uring is not available, writing " << filename << " from a helper thread" << std::endl;
+        }
+        stopping = false;
+        worker = std::thread(&AsyncFile::writeLoop, this);
+    }
+    return true;
+}
+
+bool AsyncFile::write(const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        size_t count = std::min(size, BUFFER_BYTES - fill[current]);
+        std::memcpy(buffers[current] + fill[current], p, count);
+        fill[current] += count;
+        p += count;
+        size -= count;
+        if (fill[current] == BUFFER_BYTES) {
+            submit(current);
+        }
+    }
+    return !failed;
+}
+
+// Hands the buffer to the backend and moves on to the next one, waiting for it if it is still in flight
+void AsyncFile::submit(size_t buffer) {
+    writes[buffer].offset = offset;
+    writes[buffer].done = 0;
+    offset += fill[buffer];
+    if (ring) {
+        busy[buffer] = 1;
+        inFlight++;
+        pushRingWrite(buffer);
+        reap(false);
+    } else {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy[buffer] = 1;
+        inFlight++;
+        queue.push_back(buffer);
+        changed.notify_all();
+    }
+    current = (current + 1) % BUFFER_COUNT;
+    waitFor(current);
+    fill[current] = 0;
+}
+
+void AsyncFile::waitFor(size_t buffer) {
+    if (ring) {
+        while (busy[buffer]) {
+            reap(true);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (busy[buffer]) {
+        changed.wait(lock);
+    }
+}
+
+void AsyncFile::waitAll() {
+    if (ring) {
+        while (inFlight > 0) {
+            reap(true);
+        }
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    while (inFlight > 0) {
+        changed.wait(lock);
+    }
+}
+
+void AsyncFile::writeLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        if (queue.empty()) {
+            if (stopping) {
+                return;
+            }
+            changed.wait(lock);
+            continue;
+        }
+        size_t buffer = queue.front();
+        queue.pop_front();
+        Write& pending = writes[buffer];
+        size_t bytes = fill[buffer];
+        lock.unlock();
+
+        bool ok = true;
+        while (pending.done < bytes) {
+            ssize_t written = pwrite(fd, buffers[buffer] + pending.done, bytes - pending.done,
+                                     static_cast<off_t>(pending.offset + pending.done));
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                std::cerr << "Error writing file: " << std::strerror(written < 0 ? errno : ENOSPC) << std::endl;
+                ok = false;
+                break;
+            }
+            pending.done += written;
+        }
+
+        lock.lock();
+        if (!ok) {
+            failed = true;
+        }
+        busy[buffer] = 0;
+        inFlight--;
+        changed.notify_all();
+    }
+}
+
+bool AsyncFile::flush() {
+    if (fd < 0) {
+        return false;
+    }
+    if (fill[current] > 0) {
+        submit(current);
+    }
+    waitAll();
+    return !failed;
+}
+
+bool AsyncFile::sync() {
+    if (!flush() || ::fsync(fd) != 0) {
+        failed = true;
+    }
+    return !failed;
+}
+
+bool AsyncFile::close() {
+    if (fd < 0) {
+        return false;
+    }
+    flush();
+    if (worker.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        worker.join();
+    }
+    closeRing();
+    if (::close(fd) != 0) {
+        failed = true;
+    }
+    fd = -1;
+    return !failed;
+}
+
+bool AsyncFile::isOpen() const {
+    return fd >= 0;
+}
+
+AsyncFile::Backend AsyncFile::getBackend() const {
+    return backend;
+}
+
+uint64_t AsyncFile::getSize() const {
+    return offset + fill[current];
+}
+
+void AsyncFile::setDefaultBackend(Backend requested) {
+    defaultBackend = requested;
+}
+
+const char* AsyncFile::getBackendName(Backend value) {
+    switch (value) {
+    case IO_URING:
+        return "io_uring";
+    case PWRITE_THREAD:
+        return "pwrite thread";
+    default:
+        return "auto";
+    }
+}
+
+AsyncFileStreamBuffer::AsyncFileStreamBuffer(AsyncFile& target) : file(target) {}
+
+std::streamsize AsyncFileStreamBuffer::xsputn(const char* data, std::streamsize count) {
+    return file.write(data, static_cast<size_t>(count)) ? count : 0;
+}
+
+AsyncFileStreamBuffer::int_type AsyncFileStreamBuffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    char value = traits_type::to_char_type(c);
+    return file.write(&value, 1) ? c : traits_type::eof();
+}
@@ -0,0 +1,261 @@
+#include "BinaryTrajectory.h"
+#include "LammpsDumpReader.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char HEADER_MAGIC[8] = {'M', 'C', 'S', 'T', 'R', 'A', 'J', '\0'};
+const char FOOTER_MAGIC[8] = {'M', 'C', 'S', 'I', 'D', 'X', '\0', '\0'};
+const uint32_t FORMAT_VERSION = 1;
+const size_t FOOTER_SIZE = 24;
+
+size_t frameBytes(uint64_t particles, uint32_t precision) {
+    return sizeof(int64_t) + 3 * particles * precision;
+}
+}
+
+BinaryTrajectorySink::BinaryTrajectorySink(int precision, uint64_t seed) : headerWritten(false) {
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, HEADER_MAGIC, sizeof(HEADER_MAGIC));
+    header.version = FORMAT_VERSION;
+    header.precision = precision == 4 ? 4 : 8;
+    header.seed = seed;
+}
+
+bool BinaryTrajectorySink::open(const std::string& filename, double boxSize) {
+    if (!file.open(filename)) {
+        return false;
+    }
+    header.boxSize = boxSize;
+    offsets.clear();
+    headerWritten = false;
+    return true;
+}
+
+void BinaryTrajectorySink::writeColumn(const Frame& frame, int axis) {
+    for (size_t i = 0; i < frame.count; i++) {
+        const Particle& p = frame.particles[i];
+        double value = axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+        if (header.precision == 4) {
+            float narrow = static_cast<float>(value);
+            std::memcpy(&column[i * 4], &narrow, 4);
+        } else {
+            std::memcpy(&column[i * 8], &value, 8);
+        }
+    }
+    file.write(column.data(), column.size());
+}
+
+// The particle count is fixed by the first frame; frames of another size are skipped
+bool BinaryTrajectorySink::hasFixedParticleCount() const {
+    return true;
+}
+
+bool BinaryTrajectorySink::write(const Frame& frame) {
+    if (!headerWritten) {
+        header.particleCount = frame.count;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        column.resize(frame.count * header.precision);
+        headerWritten = true;
+    }
+    if (frame.count != header.particleCount) {
+        std::cerr << "Skipping frame " << frame.step << ": " << frame.count << " particles, trajectory has "
+                  << header.particleCount << std::endl;
+        return false;
+    }
+
+    offsets.push_back(sizeof(header) + offsets.size() * frameBytes(header.particleCount, header.precision));
+    int64_t step = frame.step;
+    file.write(reinterpret_cast<const char*>(&step), sizeof(step));
+    for (int axis = 0; axis < 3; axis++) {
+        writeColumn(frame, axis);
+    }
+    return true;
+}
+
+void BinaryTrajectorySink::flush() {
+    file.flush();
+}
+
+void BinaryTrajectorySink::close() {
+    if (!file.isOpen()) {
+        return;
+    }
+    if (headerWritten) {
+        uint64_t frameCount = offsets.size();
+        uint64_t indexOffset = sizeof(header) + frameCount * frameBytes(header.particleCount, header.precision);
+        file.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        file.write(reinterpret_cast<const char*>(&frameCount), sizeof(frameCount));
+        file.write(reinterpret_cast<const char*>(&indexOffset), sizeof(indexOffset));
+        file.write(FOOTER_MAGIC, sizeof(FOOTER_MAGIC));
+    }
+    file.close();
+}
+
+BinaryTrajectoryReader::BinaryTrajectoryReader()
+    : fd(-1), data(nullptr), fileSize(0), header(nullptr), frameSize(0), frameCount(0) {}
+
+BinaryTrajectoryReader::~BinaryTrajectoryReader() {
+    close();
+}
+
+bool BinaryTrajectoryReader::open(const std::string& filename) {
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(BinaryTrajectoryHeader)) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        close();
+        return false;
+    }
+    fileSize = info.st_size;
+    void* mapping = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping file " << filename << std::endl;
+        close();
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+    header = reinterpret_cast<const BinaryTrajectoryHeader*>(data);
+    if (std::memcmp(header->magic, HEADER_MAGIC, sizeof(HEADER_MAGIC)) != 0 || header->version != FORMAT_VERSION ||
+        (header->precision != 4 && header->precision != 8) || header->particleCount > fileSize) {
+        std::cerr << filename << " is not a binary trajectory" << std::endl;
+        close();
+        return false;
+    }
+    frameSize = frameBytes(header->particleCount, header->precision);
+
+    // Use the footer when present, otherwise count the complete frames; a
+    // footer count is never allowed past the frames the file can hold
+    const char* footer = data + fileSize - FOOTER_SIZE;
+    if (fileSize >= sizeof(BinaryTrajectoryHeader) + FOOTER_SIZE &&
+        std::memcmp(footer + 16, FOOTER_MAGIC, sizeof(FOOTER_MAGIC)) == 0) {
+        uint64_t count;
+        std::memcpy(&count, footer, sizeof(count));
+        frameCount = std::min<uint64_t>(count, (fileSize - sizeof(BinaryTrajectoryHeader) - FOOTER_SIZE) / frameSize);
+    } else {
+        frameCount = (fileSize - sizeof(BinaryTrajectoryHeader)) / frameSize;
+    }
+    return true;
+}
+
+void BinaryTrajectoryReader::close() {
+    if (data) {
+        munmap(const_cast<char*>(data), fileSize);
+    }
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+    data = nullptr;
+    header = nullptr;
+    fileSize = frameSize = frameCount = 0;
+}
+
+size_t BinaryTrajectoryReader::getFrameCount() const {
+    return frameCount;
+}
+
+size_t BinaryTrajectoryReader::getParticleCount() const {
+    return header ? header->particleCount : 0;
+}
+
+double BinaryTrajectoryReader::getBoxSize() const {
+    return header ? header->boxSize : 0.0;
+}
+
+uint64_t BinaryTrajectoryReader::getSeed() const {
+    return header ? header->seed : 0;
+}
+
+int BinaryTrajectoryReader::getPrecision() const {
+    return header ? header->precision : 0;
+}
+
+int64_t BinaryTrajectoryReader::getStep(size_t frame) const {
+    int64_t step;
+    std::memcpy(&step, data + sizeof(BinaryTrajectoryHeader) + frame * frameSize, sizeof(step));
+    return step;
+}
+
+const void* BinaryTrajectoryReader::getColumn(size_t frame, int axis) const {
+    return data + sizeof(BinaryTrajectoryHeader) + frame * frameSize + sizeof(int64_t) +
+           axis * header->particleCount * header->precision;
+}
+
+void BinaryTrajectoryReader::readFrame(size_t frame, std::vector<Particle>& particles) const {
+    size_t count = header->particleCount;
+    particles.resize(count);
+    for (int axis = 0; axis < 3; axis++) {
+        const char* column = static_cast<const char*>(getColumn(frame, axis));
+        for (size_t i = 0; i < count; i++) {
+            double value;
+            if (header->precision == 4) {
+                float narrow;
+                std::memcpy(&narrow, column + i * 4, 4);
+                value = narrow;
+            } else {
+                std::memcpy(&value, column + i * 8, 8);
+            }
+            double& target = axis == 0 ? particles[i].x : (axis == 1 ? particles[i].y : particles[i].z);
+            target = value;
+        }
+    }
+}
+
+bool convertLammpsToBinary(const std::string& input, const std::string& output, int precision, size_t first,
+                           size_t last) {
+    LammpsDumpReader reader;
+    if (!reader.open(input) || !reader.seekFrame(input, first)) {
+        return false;
+    }
+    int step;
+    double boxSize = 0.0;
+    std::vector<Particle> particles;
+    if (last < first || !reader.next(step, boxSize, particles)) {
+        std::cerr << "No frames in " << input << std::endl;
+        return false;
+    }
+
+    BinaryTrajectorySink sink(precision);
+    if (!sink.open(output, boxSize)) {
+        return false;
+    }
+    size_t index = first;
+    do {
+        Frame frame;
+        frame.step = step;
+        frame.particles = particles.data();
+        frame.count = particles.size();
+        sink.write(frame);
+    } while (index++ < last && reader.next(step, boxSize, particles));
+    sink.close();
+    return true;
+}
+
+bool convertBinaryToLammps(const std::string& input, const std::string& output, size_t first, size_t last) {
+    BinaryTrajectoryReader reader;
+    if (!reader.open(input)) {
+        return false;
+    }
+    LammpsDumpSink sink(false);
+    if (!sink.open(output, reader.getBoxSize())) {
+        return false;
+    }
+    std::vector<Particle> particles;
+    for (size_t f = first; f < reader.getFrameCount() && f <= last; f++) {
+        reader.readFrame(f, particles);
+        Frame frame;
+        frame.step = static_cast<int>(reader.getStep(f));
+        frame.particles = particles.data();
+        frame.count = particles.size();
+        sink.write(frame);
+    }
+    sink.close();
+    return true;
+}
@@ -0,0 +1,414 @@
+#include "CompressedTrajectory.h"
+#include "LammpsDumpReader.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+const char MAGIC[8] = {'M', 'C', 'S', 'Z', 'T', 'R', 'J', '\0'};
+const uint32_t FORMAT_VERSION = 1;
+const size_t CHUNK_PARTICLES = 16384;
+const size_t RICE_BLOCK = 64;      // Values sharing one Rice parameter
+const int ESCAPE = 32;             // Quotients this large are stored raw
+const uint32_t KEYFRAME_FLAG = 1;
+
+// Little-endian bit packing, least significant bit first
+class BitWriter {
+private:
+    std::vector<uint8_t>& out;
+    uint64_t accumulator;
+    int bits;
+
+public:
+    explicit BitWriter(std::vector<uint8_t>& buffer) : out(buffer), accumulator(0), bits(0) {}
+
+    void put(uint64_t value, int count) {  // count <= 32
+        accumulator |= (value & ((1ull << count) - 1)) << bits;
+        bits += count;
+        while (bits >= 8) {
+            out.push_back(static_cast<uint8_t>(accumulator));
+            accumulator >>= 8;
+            bits -= 8;
+        }
+    }
+
+    void finish() {
+        if (bits > 0) {
+            out.push_back(static_cast<uint8_t>(accumulator));
+        }
+        accumulator = 0;
+        bits = 0;
+    }
+};
+
+class BitReader {
+private:
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint64_t accumulator;
+    int bits;
+
+public:
+    BitReader(const uint8_t* bytes, size_t length) : data(bytes), size(length), position(0), accumulator(0), bits(0) {}
+
+    uint64_t get(int count) {  // count <= 32
+        while (bits < count) {
+            uint64_t byte = position < size ? data[position] : 0;
+            position++;
+            accumulator |= byte << bits;
+            bits += 8;
+        }
+        uint64_t value = accumulator & ((1ull << count) - 1);
+        accumulator >>= count;
+        bits -= count;
+        return value;
+    }
+};
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// Rice parameter close to log2 of the mean value of the block
+int riceParameter(const uint64_t* values, size_t count) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += values[i];
+    }
+    uint64_t mean = sum / count;
+    int k = 0;
+    while (k < 31 && (2ull << k) <= mean) {
+        k++;
+    }
+    return k;
+}
+
+void encodeValues(const std::vector<uint64_t>& values, std::vector<uint8_t>& out) {
+    BitWriter writer(out);
+    for (size_t begin = 0; begin < values.size(); begin += RICE_BLOCK) {
+        size_t count = std::min(RICE_BLOCK, values.size() - begin);
+        int k = riceParameter(&values[begin], count);
+        writer.put(k, 5);
+        for (size_t i = begin; i < begin + count; i++) {
+            uint64_t quotient = values[i] >> k;
+            if (quotient < static_cast<uint64_t>(ESCAPE)) {
+                writer.put((1ull << quotient) - 1, static_cast<int>(quotient));
+                writer.put(0, 1);
+                writer.put(values[i], k);
+            } else {
+                writer.put((1ull << ESCAPE) - 1, ESCAPE);
+                writer.put(values[i], 32);
+            }
+        }
+    }
+    writer.finish();
+}
+
+void decodeValues(const uint8_t* data, size_t size, std::vector<uint64_t>& values) {
+    BitReader reader(data, size);
+    for (size_t begin = 0; begin < values.size(); begin += RICE_BLOCK) {
+        size_t count = std::min(RICE_BLOCK, values.size() - begin);
+        int k = static_cast<int>(reader.get(5));
+        for (size_t i = begin; i < begin + count; i++) {
+            int quotient = 0;
+            while (quotient < ESCAPE && reader.get(1) == 1) {
+                quotient++;
+            }
+            if (quotient == ESCAPE) {
+                values[i] = reader.get(32);
+            } else {
+                values[i] = (static_cast<uint64_t>(quotient) << k) | reader.get(k);
+            }
+        }
+    }
+}
+}
+
+CompressedTrajectorySink::CompressedTrajectorySink(double precision, int keyframeInterval, uint64_t seed)
+    : headerWritten(false), framesWritten(0) {
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = FORMAT_VERSION;
+    header.keyframeInterval = keyframeInterval > 0 ? keyframeInterval : 1;
+    header.levels = static_cast<uint64_t>(std::ceil(1.0 / std::max(precision, 1e-9)));
+    header.levels = std::min<uint64_t>(header.levels, 1ull << 31);
+    header.precision = 1.0 / header.levels;
+    header.seed = seed;
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+bool CompressedTrajectorySink::open(const std::string& filename, double boxSize) {
+    if (!file.open(filename)) {
+        return false;
+    }
+    header.boxSize = boxSize;
+    headerWritten = false;
+    framesWritten = 0;
+    return true;
+}
+
+// Quantise, difference and Rice-code one chunk of particles, axis by axis
+void CompressedTrajectorySink::encodeChunk(const Frame& frame, size_t chunk, bool keyframe) {
+    size_t begin = chunk * CHUNK_PARTICLES;
+    size_t count = std::min(CHUNK_PARTICLES, frame.count - begin);
+    int64_t levels = static_cast<int64_t>(header.levels);
+    double scale = header.levels / header.boxSize;
+
+    std::vector<uint64_t> values(3 * count);
+    for (int axis = 0; axis < 3; axis++) {
+        for (size_t i = 0; i < count; i++) {
+            const Particle& p = frame.particles[begin + i];
+            double coordinate = axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+            int64_t q = static_cast<int64_t>(std::floor(coordinate * scale + 0.5)) % levels;
+            if (q < 0) {
+                q += levels;
+            }
+            uint32_t& last = previous[3 * (begin + i) + axis];
+            int64_t delta = q - (keyframe ? 0 : static_cast<int64_t>(last));
+            if (!keyframe) {
+                if (delta >= levels / 2) {
+                    delta -= levels;
+                } else if (delta < -(levels / 2)) {
+                    delta += levels;
+                }
+            }
+            values[axis * count + i] = zigzag(delta);
+            last = static_cast<uint32_t>(q);
+        }
+    }
+
+    chunkData[chunk].clear();
+    encodeValues(values, chunkData[chunk]);
+}
+
+bool CompressedTrajectorySink::hasFixedParticleCount() const {
+    return true;
+}
+
+bool CompressedTrajectorySink::write(const Frame& frame) {
+    if (!headerWritten) {
+        header.particleCount = frame.count;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        previous.assign(3 * frame.count, 0);
+        headerWritten = true;
+    }
+    if (frame.count != header.particleCount) {
+        std::cerr << "Skipping frame " << frame.step << ": " << frame.count << " particles, trajectory has "
+                  << header.particleCount << std::endl;
+        return false;
+    }
+
+    bool keyframe = framesWritten % header.keyframeInterval == 0;
+    size_t chunks = (frame.count + CHUNK_PARTICLES - 1) / CHUNK_PARTICLES;
+    chunkData.resize(chunks);
+
+    // Chunks are independent, so threads take every numThreads-th chunk
+    std::vector<std::thread> workers;
+    int threads = static_cast<int>(std::min<size_t>(numThreads, chunks));
+    for (int t = 1; t < threads; t++) {
+        workers.push_back(std::thread([this, &frame, chunks, threads, keyframe, t]() {
+            for (size_t c = t; c < chunks; c += threads) {
+                encodeChunk(frame, c, keyframe);
+            }
+        }));
+    }
+    for (size_t c = 0; c < chunks; c += std::max(threads, 1)) {
+        encodeChunk(frame, c, keyframe);
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    int64_t step = frame.step;
+    uint32_t flags = keyframe ? KEYFRAME_FLAG : 0;
+    uint32_t chunkCount = static_cast<uint32_t>(chunks);
+    file.write(reinterpret_cast<const char*>(&step), sizeof(step));
+    file.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+    file.write(reinterpret_cast<const char*>(&chunkCount), sizeof(chunkCount));
+    for (size_t c = 0; c < chunks; c++) {
+        uint32_t bytes = static_cast<uint32_t>(chunkData[c].size());
+        file.write(reinterpret_cast<const char*>(&bytes), sizeof(bytes));
+    }
+    for (size_t c = 0; c < chunks; c++) {
+        file.write(reinterpret_cast<const char*>(chunkData[c].data()), chunkData[c].size());
+    }
+    framesWritten++;
+    return true;
+}
+
+void CompressedTrajectorySink::flush() {
+    file.flush();
+}
+
+void CompressedTrajectorySink::close() {
+    file.close();
+}
+
+CompressedTrajectoryReader::CompressedTrajectoryReader() : fileSize(0) {
+    std::memset(&header, 0, sizeof(header));
+}
+
+bool CompressedTrajectoryReader::open(const std::string& filename) {
+    file.open(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    std::streamoff end = file.tellg();
+    file.seekg(0, std::ios::beg);
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != FORMAT_VERSION) {
+        std::cerr << filename << " is not a compressed trajectory" << std::endl;
+        return false;
+    }
+    fileSize = static_cast<uint64_t>(end);
+
+    // Every coordinate takes at least one bit, so a count the rest of the file
+    // cannot hold is a corrupt header rather than something to allocate for
+    uint64_t payloadBits = (fileSize - sizeof(header)) * 8;
+    if (header.levels == 0 || header.levels > (1ull << 31) || header.particleCount > payloadBits / 3) {
+        std::cerr << filename << " has a corrupt header" << std::endl;
+        return false;
+    }
+    previous.assign(3 * header.particleCount, 0);
+    return true;
+}
+
+bool CompressedTrajectoryReader::next(int& step, std::vector<Particle>& particles) {
+    int64_t frameStep;
+    uint32_t flags, chunkCount;
+    file.read(reinterpret_cast<char*>(&frameStep), sizeof(frameStep));
+    file.read(reinterpret_cast<char*>(&flags), sizeof(flags));
+    file.read(reinterpret_cast<char*>(&chunkCount), sizeof(chunkCount));
+    if (!file) {
+        return false;
+    }
+    size_t count = header.particleCount;
+    if (chunkCount != (count + CHUNK_PARTICLES - 1) / CHUNK_PARTICLES) {
+        std::cerr << "Frame " << frameStep << " has " << chunkCount << " chunks for " << count << " particles"
+                  << std::endl;
+        return false;
+    }
+    std::vector<uint32_t> chunkBytes(chunkCount);
+    file.read(reinterpret_cast<char*>(chunkBytes.data()), chunkCount * sizeof(uint32_t));
+    if (!file) {
+        return false;
+    }
+    uint64_t remaining = fileSize - std::min<uint64_t>(fileSize, static_cast<uint64_t>(file.tellg()));
+    for (uint32_t c = 0; c < chunkCount; c++) {
+        if (chunkBytes[c] > remaining) {
+            return false;  // Truncated
+        }
+        remaining -= chunkBytes[c];
+    }
+
+    bool keyframe = (flags & KEYFRAME_FLAG) != 0;
+    int64_t levels = static_cast<int64_t>(header.levels);
+    double scale = header.boxSize / header.levels;
+    particles.resize(count);
+    std::vector<uint64_t> values;
+
+    for (uint32_t c = 0; c < chunkCount; c++) {
+        buffer.resize(chunkBytes[c]);
+        file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+        if (!file) {
+            return false;
+        }
+        size_t begin = c * CHUNK_PARTICLES;
+        size_t chunkParticles = std::min(CHUNK_PARTICLES, count - begin);
+        values.resize(3 * chunkParticles);
+        decodeValues(buffer.data(), buffer.size(), values);
+
+        for (int axis = 0; axis < 3; axis++) {
+            for (size_t i = 0; i < chunkParticles; i++) {
+                uint32_t& last = previous[3 * (begin + i) + axis];
+                int64_t q = unzigzag(values[axis * chunkParticles + i]) + (keyframe ? 0 : static_cast<int64_t>(last));
+                q %= levels;
+                if (q < 0) {
+                    q += levels;
+                }
+                last = static_cast<uint32_t>(q);
+                double& target = axis == 0 ? particles[begin + i].x : (axis == 1 ? particles[begin + i].y : particles[begin + i].z);
+                target = q * scale;
+            }
+        }
+    }
+    step = static_cast<int>(frameStep);
+    return true;
+}
+
+size_t CompressedTrajectoryReader::getParticleCount() const {
+    return header.particleCount;
+}
+
+double CompressedTrajectoryReader::getBoxSize() const {
+    return header.boxSize;
+}
+
+double CompressedTrajectoryReader::getMaxError() const {
+    return 0.5 * header.boxSize / header.levels;
+}
+
+bool convertLammpsToCompressed(const std::string& input, const std::string& output, double precision, size_t first,
+                               size_t last) {
+    LammpsDumpReader reader;
+    if (!reader.open(input) || !reader.seekFrame(input, first)) {
+        return false;
+    }
+    int step;
+    double boxSize = 0.0;
+    std::vector<Particle> particles;
+    if (last < first || !reader.next(step, boxSize, particles)) {
+        std::cerr << "No frames in " << input << std::endl;
+        return false;
+    }
+
+    CompressedTrajectorySink sink(precision);
+    if (!sink.open(output, boxSize)) {
+        return false;
+    }
+    size_t index = first;
+    do {
+        Frame frame;
+        frame.step = step;
+        frame.particles = particles.data();
+        frame.count = particles.size();
+        sink.write(frame);
+    } while (index++ < last && reader.next(step, boxSize, particles));
+    sink.close();
+    return true;
+}
+
+bool convertCompressedToLammps(const std::string& input, const std::string& output, size_t first, size_t last) {
+    CompressedTrajectoryReader reader;
+    if (!reader.open(input)) {
+        return false;
+    }
+    LammpsDumpSink sink(false);
+    if (!sink.open(output, reader.getBoxSize())) {
+        return false;
+    }
+    // Frames before the first are decoded too, since each one is a delta on its predecessor
+    int step;
+    std::vector<Particle> particles;
+    for (size_t index = 0; index <= last && reader.next(step, particles); index++) {
+        if (index < first) {
+            continue;
+        }
+        Frame frame;
+        frame.step = step;
+        frame.particles = particles.data();
+        frame.count = particles.size();
+        sink.write(frame);
+    }
+    sink.close();
+    return true;
+}
@@ -0,0 +1,374 @@
+#include "ConfigurationLoader.h"
+#include "BinaryTrajectory.h"
+#include "CompressedTrajectory.h"
+#include "LammpsFrameIndex.h"
+#include "MappedFile.h"
+#include "MoveLog.h"
+#include "TextFormat.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+const char TIMESTEP_ITEM[] = "ITEM: TIMESTEP";
+const size_t MIN_BYTES_PER_THREAD = 1 << 20;
+
+// Where the wanted columns of a particle line are; other columns are skipped unparsed
+struct AtomLayout {
+    int columns;
+    int id;  // -1: particles are stored in line order
+    int x, y, z;
+};
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+bool startsWith(const char* p, const char* end, const char* prefix) {
+    size_t length = std::strlen(prefix);
+    return static_cast<size_t>(end - p) >= length && std::memcmp(p, prefix, length) == 0;
+}
+
+const char* lineEnd(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline : end;
+}
+
+const char* nextLine(const char* p, const char* end) {
+    const char* newline = lineEnd(p, end);
+    return newline < end ? newline + 1 : end;
+}
+
+const char* skipToken(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    const char* start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') {
+        p++;
+    }
+    return p > start ? p : nullptr;
+}
+
+size_t countLines(const char* begin, const char* end) {
+    size_t lines = 0;
+    for (const char* p = begin; p < end; p = nextLine(p, end)) {
+        lines++;
+    }
+    return lines;
+}
+
+// Parses the particle lines in [begin, end); firstLine is the index of the first of them
+bool parseAtomLines(const char* begin, const char* end, size_t firstLine, const AtomLayout& layout,
+                    std::vector<Particle>& particles) {
+    size_t line = firstLine;
+    for (const char* p = begin; p < end; p = nextLine(p, end), line++) {
+        const char* stop = lineEnd(p, end);
+        const char* q = p;
+        double id = 0.0, x = 0.0, y = 0.0, z = 0.0;
+        for (int c = 0; c < layout.columns && q != nullptr; c++) {
+            if (c == layout.x) {
+                q = parseDouble(q, stop, x);
+            } else if (c == layout.y) {
+                q = parseDouble(q, stop, y);
+            } else if (c == layout.z) {
+                q = parseDouble(q, stop, z);
+            } else if (c == layout.id) {
+                q = parseDouble(q, stop, id);
+            } else {
+                q = skipToken(q, stop);
+            }
+        }
+        size_t index = layout.id >= 0 ? static_cast<size_t>(id) - 1 : line;
+        if (q == nullptr || (layout.id >= 0 && id < 1.0) || index >= particles.size()) {
+            return false;
+        }
+        particles[index] = Particle(x, y, z);
+    }
+    return true;
+}
+
+// Splits the particle lines into per-thread pieces at line boundaries, counts
+// the lines of each piece so every thread knows its first line index, then
+// parses the pieces concurrently
+bool parseAtomsParallel(const char* begin, const char* end, const AtomLayout& layout,
+                        std::vector<Particle>& particles) {
+    size_t bytes = end - begin;
+    size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    numThreads = std::max<size_t>(1, std::min(numThreads, bytes / MIN_BYTES_PER_THREAD));
+
+    std::vector<const char*> bounds(1, begin);
+    for (size_t t = 1; t < numThreads; t++) {
+        const char* cut = std::max(begin + bytes * t / numThreads, bounds.back());
+        bounds.push_back(cut < end ? nextLine(cut, end) : end);
+    }
+    bounds.push_back(end);
+
+    std::vector<size_t> firstLine(numThreads + 1, 0);
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < numThreads; t++) {
+        workers.push_back(std::thread([&, t]() { firstLine[t + 1] = countLines(bounds[t], bounds[t + 1]); }));
+    }
+    firstLine[1] = countLines(bounds[0], bounds[1]);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (size_t t = 1; t <= numThreads; t++) {
+        firstLine[t] += firstLine[t - 1];
+    }
+    if (firstLine[numThreads] != particles.size()) {
+        return false;
+    }
+
+    std::vector<char> ok(numThreads, 0);
+    workers.clear();
+    for (size_t t = 1; t < numThreads; t++) {
+        workers.push_back(std::thread([&, t]() {
+            ok[t] = parseAtomLines(bounds[t], bounds[t + 1], firstLine[t], layout, particles);
+        }));
+    }
+    ok[0] = parseAtomLines(bounds[0], bounds[1], 0, layout, particles);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    return std::find(ok.begin(), ok.end(), 0) == ok.end();
+}
+
+// Start of the frame'th ITEM: TIMESTEP line, or of the last one for frame < 0.
+// A current sidecar index gives it directly; otherwise the dump is searched,
+// backwards for the last frame since only ITEM lines contain an 'I'.
+const char* findLammpsFrame(const std::string& filename, const char* data, size_t size, long long frame) {
+    const char* end = data + size;
+    LammpsFrameIndex index;
+    if (index.load(LammpsFrameIndex::sidecarFilename(filename)) && index.isCurrent(filename) &&
+        index.getFrameCount() > 0) {
+        size_t selected = frame < 0 ? index.getFrameCount() - 1 : static_cast<size_t>(frame);
+        return selected < index.getFrameCount() && index.getOffset(selected) < size ? data + index.getOffset(selected)
+                                                                                     : nullptr;
+    }
+    if (frame < 0) {
+        const char* p = end;
+        while ((p = static_cast<const char*>(memrchr(data, 'I', p - data))) != nullptr) {
+            if (findLammpsTimestep(data, p, end) == p) {
+                return p;
+            }
+        }
+        return nullptr;
+    }
+    const char* p = findLammpsTimestep(data, data, end);
+    for (long long seen = 0; p < end && seen < frame; seen++) {
+        p = findLammpsTimestep(data, p + 1, end);
+    }
+    return p < end ? p : nullptr;
+}
+
+bool loadLammps(const std::string& filename, const MappedFile& file, long long frame, Configuration& configuration) {
+    const char* end = file.getEnd();
+    const char* p = findLammpsFrame(filename, file.getData(), file.getSize(), frame);
+    if (p == nullptr) {
+        return false;
+    }
+
+    // The handful of header lines are parsed serially
+    double step = 0.0, count = -1.0, low = 0.0, high = 0.0;
+    AtomLayout layout = {0, -1, -1, -1, -1};
+    while (p < end && layout.columns == 0) {
+        const char* line = p;
+        const char* stop = lineEnd(line, end);
+        p = nextLine(p, end);
+        if (startsWith(line, stop, TIMESTEP_ITEM)) {
+            parseDouble(p, lineEnd(p, end), step);
+            p = nextLine(p, end);
+        } else if (startsWith(line, stop, "ITEM: NUMBER OF ATOMS")) {
+            parseDouble(p, lineEnd(p, end), count);
+            p = nextLine(p, end);
+        } else if (startsWith(line, stop, "ITEM: BOX BOUNDS")) {
+            const char* q = parseDouble(p, lineEnd(p, end), low);
+            if (q != nullptr) {
+                parseDouble(q, lineEnd(p, end), high);
+            }
+            for (int axis = 0; axis < 3; axis++) {
+                p = nextLine(p, end);
+            }
+        } else if (startsWith(line, stop, "ITEM: ATOMS")) {
+            for (const char* q = line + 11; ; ) {
+                while (q < stop && (*q == ' ' || *q == '\t' || *q == '\r')) {
+                    q++;
+                }
+                if (q == stop) {
+                    break;
+                }
+                const char* name = q;
+                while (q < stop && *q != ' ' && *q != '\t' && *q != '\r') {
+                    q++;
+                }
+                std::string column(name, q);
+                if (column == "id") layout.id = layout.columns;
+                if (column == "x") layout.x = layout.columns;
+                if (column == "y") layout.y = layout.columns;
+                if (column == "z") layout.z = layout.columns;
+                layout.columns++;
+            }
+            if (layout.columns == 0) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    if (layout.id < 0 || layout.x < 0 || layout.y < 0 || layout.z < 0 || count < 0.0) {
+        return false;
+    }
+
+    // The particle lines run to the next frame or the end of the file
+    const char* bodyEnd = findLammpsTimestep(file.getData(), p, end);
+    configuration.step = static_cast<int64_t>(step);
+    configuration.boxSize = high - low;
+    configuration.particles.assign(static_cast<size_t>(count), Particle());
+    if (!parseAtomsParallel(p, bodyEnd, layout, configuration.particles)) {
+        return false;
+    }
+
+    // Shift the box to start at the origin, as the simulation expects
+    if (low != 0.0) {
+        for (size_t i = 0; i < configuration.particles.size(); i++) {
+            configuration.particles[i].move(-low, -low, -low);
+        }
+    }
+    return true;
+}
+
+// Box length from an extended-XYZ comment, Lattice="ax ay az bx by bz cx cy cz"
+double xyzLatticeLength(const char* comment, const char* end) {
+    const char key[] = "Lattice=\"";
+    const char* p = static_cast<const char*>(memmem(comment, end - comment, key, sizeof(key) - 1));
+    double length = 0.0;
+    if (p != nullptr && parseDouble(p + sizeof(key) - 1, end, length) == nullptr) {
+        length = 0.0;
+    }
+    return length;
+}
+
+bool loadXyz(const MappedFile& file, long long frame, Configuration& configuration) {
+    const char* end = file.getEnd();
+    const char* p = file.getData();
+    const char* selected = nullptr;
+    double count = 0.0;
+    for (long long index = 0; p < end; index++) {
+        double frameCount;
+        if (parseDouble(p, lineEnd(p, end), frameCount) == nullptr) {
+            break;  // Trailing blank lines
+        }
+        if (frame < 0 || index == frame) {
+            selected = p;
+            count = frameCount;
+            configuration.step = index;
+            if (index == frame) {
+                break;
+            }
+        }
+        p = nextLine(nextLine(p, end), end);
+        for (size_t i = 0; i < static_cast<size_t>(frameCount) && p < end; i++) {
+            p = nextLine(p, end);
+        }
+    }
+    if (selected == nullptr || count < 0.0) {
+        return false;
+    }
+
+    const char* comment = nextLine(selected, end);
+    const char* body = nextLine(comment, end);
+    const char* bodyEnd = body;
+    for (size_t i = 0; i < static_cast<size_t>(count) && bodyEnd < end; i++) {
+        bodyEnd = nextLine(bodyEnd, end);
+    }
+    configuration.boxSize = xyzLatticeLength(comment, lineEnd(comment, end));
+    configuration.particles.assign(static_cast<size_t>(count), Particle());
+    AtomLayout layout = {4, -1, 1, 2, 3};
+    return parseAtomsParallel(body, bodyEnd, layout, configuration.particles);
+}
+
+bool loadBinary(const std::string& filename, long long frame, Configuration& configuration) {
+    BinaryTrajectoryReader reader;
+    if (!reader.open(filename) || reader.getFrameCount() == 0) {
+        return false;
+    }
+    size_t index = frame < 0 ? reader.getFrameCount() - 1 : static_cast<size_t>(frame);
+    if (index >= reader.getFrameCount()) {
+        return false;
+    }
+    configuration.step = reader.getStep(index);
+    configuration.boxSize = reader.getBoxSize();
+    reader.readFrame(index, configuration.particles);
+    return true;
+}
+
+// Delta-coded frames can only be decoded in order from the start
+bool loadCompressed(const std::string& filename, long long frame, Configuration& configuration) {
+    CompressedTrajectoryReader reader;
+    if (!reader.open(filename)) {
+        return false;
+    }
+    int step;
+    std::vector<Particle> particles;
+    bool found = false;
+    for (long long index = 0; reader.next(step, particles); index++) {
+        if (frame < 0 || index == frame) {
+            configuration.step = step;
+            configuration.particles.swap(particles);
+            found = true;
+            if (index == frame) {
+                break;
+            }
+        }
+    }
+    configuration.boxSize = reader.getBoxSize();
+    return found;
+}
+
+// A move log is addressed by step; only the keyframe before it and the moves up to it are read
+bool loadMoveLog(const std::string& filename, long long frame, Configuration& configuration) {
+    if (frame > INT_MAX) {
+        return false;
+    }
+    int step = frame < 0 ? INT_MAX : static_cast<int>(frame);
+    MoveLog log;
+    if (!log.load(filename, step, step)) {
+        return false;
+    }
+    if (frame < 0) {
+        step = log.getLastStep();
+    }
+    configuration.step = step;
+    configuration.boxSize = log.getBoxSize();
+    return log.reconstruct(step, configuration.particles);
+}
+}
+
+bool loadConfiguration(const std::string& filename, long long frame, Configuration& configuration) {
+    configuration.step = 0;
+    configuration.boxSize = 0.0;
+    configuration.particles.clear();
+
+    bool ok;
+    if (endsWith(filename, ".mctraj")) {
+        ok = loadBinary(filename, frame, configuration);
+    } else if (endsWith(filename, ".mcz")) {
+        ok = loadCompressed(filename, frame, configuration);
+    } else if (endsWith(filename, ".mclog")) {
+        ok = loadMoveLog(filename, frame, configuration);
+    } else {
+        MappedFile file;
+        if (!file.open(filename)) {
+            return false;
+        }
+        ok = endsWith(filename, ".xyz") ? loadXyz(file, frame, configuration)
+                                        : loadLammps(filename, file, frame, configuration);
+    }
+    if (!ok) {
+        std::cerr << "No readable frame " << frame << " in " << filename << std::endl;
+    }
+    return ok;
+}
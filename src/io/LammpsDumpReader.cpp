@@ -0,0 +1,82 @@
+#include "LammpsDumpReader.h"
+#include "LammpsFrameIndex.h"
+#include <iostream>
+#include <sstream>
+
+bool LammpsDumpReader::open(const std::string& filename) {
+    file.open(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool LammpsDumpReader::seek(uint64_t offset) {
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(offset));
+    return static_cast<bool>(file);
+}
+
+bool LammpsDumpReader::seekFrame(const std::string& filename, size_t frame) {
+    if (frame == 0) {
+        return seek(0);
+    }
+    LammpsFrameIndex index;
+    if (!index.open(filename) || frame >= index.getFrameCount()) {
+        std::cerr << "No frame " << frame << " in " << filename << std::endl;
+        return false;
+    }
+    return seek(index.getOffset(frame));
+}
+
+bool LammpsDumpReader::next(int& step, double& boxSize, std::vector<Particle>& particles) {
+    std::string line;
+    size_t count = 0;
+    bool haveStep = false;
+
+    while (std::getline(file, line)) {
+        if (line.compare(0, 14, "ITEM: TIMESTEP") == 0) {
+            file >> step;
+            haveStep = true;
+        } else if (line.compare(0, 21, "ITEM: NUMBER OF ATOMS") == 0) {
+            file >> count;
+        } else if (line.compare(0, 16, "ITEM: BOX BOUNDS") == 0) {
+            double low, high;
+            file >> low >> high;
+            boxSize = high - low;
+            file >> low >> high >> low >> high;
+        } else if (line.compare(0, 11, "ITEM: ATOMS") == 0) {
+            // Locate the id, x, y and z columns from the header
+            std::istringstream columns(line.substr(11));
+            std::string name;
+            int idColumn = -1, xColumn = -1, yColumn = -1, zColumn = -1, numColumns = 0;
+            while (columns >> name) {
+                if (name == "id") idColumn = numColumns;
+                if (name == "x") xColumn = numColumns;
+                if (name == "y") yColumn = numColumns;
+                if (name == "z") zColumn = numColumns;
+                numColumns++;
+            }
+            if (!haveStep || idColumn < 0 || xColumn < 0 || yColumn < 0 || zColumn < 0) {
+                return false;
+            }
+
+            particles.assign(count, Particle());
+            std::vector<double> values(numColumns);
+            for (size_t i = 0; i < count; i++) {
+                for (int c = 0; c < numColumns; c++) {
+                    file >> values[c];
+                }
+                size_t id = static_cast<size_t>(values[idColumn]);
+                if (!file || id < 1 || id > count) {
+                    return false;
+                }
+                particles[id - 1] = Particle(values[xColumn], values[yColumn], values[zColumn]);
+            }
+            std::getline(file, line);  // Rest of the last atom line
+            return true;
+        }
+    }
+    return false;
+}
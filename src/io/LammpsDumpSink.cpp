@@ -0,0 +1,106 @@
+#include "TrajectorySink.h"
+#include "TextFormat.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace {
+const size_t MAX_LINE = 128;                 // id and three coordinates, generously
+const size_t MIN_PARTICLES_PER_THREAD = 16384;
+
+char* appendText(char* out, const char* text) {
+    size_t length = std::strlen(text);
+    std::memcpy(out, text, length);
+    return out + length;
+}
+}
+
+LammpsDumpSink::LammpsDumpSink(bool appendToFile, int textPrecision)
+    : boxSize(0.0), append(appendToFile), precision(textPrecision) {
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+    headerBuffer.resize(512);
+}
+
+LammpsDumpSink::~LammpsDumpSink() {
+    close();
+}
+
+bool LammpsDumpSink::open(const std::string& filename, double size) {
+    if (!file.open(filename, append)) {
+        return false;
+    }
+    boxSize = size;
+    return true;
+}
+
+size_t LammpsDumpSink::formatChunk(const Frame& frame, size_t begin, size_t end, std::vector<char>& buffer) const {
+    if (buffer.size() < (end - begin) * MAX_LINE) {
+        buffer.resize((end - begin) * MAX_LINE);
+    }
+    char* out = buffer.data();
+    for (size_t i = begin; i < end; ++i) {
+        const Particle& p = frame.particles[i];
+        out = formatInteger(out, static_cast<long long>(frame.ids ? frame.ids[i] + 1 : i + 1));
+        *out++ = ' ';
+        out = formatGeneral(out, p.x, precision);
+        *out++ = ' ';
+        out = formatGeneral(out, p.y, precision);
+        *out++ = ' ';
+        out = formatGeneral(out, p.z, precision);
+        *out++ = '\n';
+    }
+    return out - buffer.data();
+}
+
+bool LammpsDumpSink::write(const Frame& frame) {
+    if (!file.isOpen()) {
+        return false;
+    }
+
+    char* out = headerBuffer.data();
+    out = appendText(out, "ITEM: TIMESTEP\n");
+    out = formatInteger(out, frame.step);
+    out = appendText(out, "\nITEM: NUMBER OF ATOMS\n");
+    out = formatInteger(out, static_cast<long long>(frame.count));
+    out = appendText(out, "\nITEM: BOX BOUNDS pp pp pp\n");
+    for (int axis = 0; axis < 3; axis++) {
+        out = appendText(out, "0 ");
+        out = formatGeneral(out, boxSize, precision);
+        *out++ = '\n';
+    }
+    out = appendText(out, "ITEM: ATOMS id x y z\n");
+    bool ok = file.write(headerBuffer.data(), out - headerBuffer.data());
+
+    // Split the atoms into one contiguous chunk per thread, format them all, then write in order
+    size_t chunks = std::min<size_t>(numThreads, std::max<size_t>(1, frame.count / MIN_PARTICLES_PER_THREAD));
+    size_t perChunk = (frame.count + chunks - 1) / chunks;
+    chunkBuffers.resize(std::max(chunkBuffers.size(), chunks));
+    std::vector<size_t> lengths(chunks, 0);
+    std::vector<std::thread> workers;
+    for (size_t c = 1; c < chunks; c++) {
+        workers.push_back(std::thread([this, &frame, &lengths, c, perChunk]() {
+            size_t begin = std::min(frame.count, c * perChunk);
+            size_t end = std::min(frame.count, begin + perChunk);
+            lengths[c] = formatChunk(frame, begin, end, chunkBuffers[c]);
+        }));
+    }
+    lengths[0] = formatChunk(frame, 0, std::min(frame.count, perChunk), chunkBuffers[0]);
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+    for (size_t c = 0; c < chunks; c++) {
+        ok = file.write(chunkBuffers[c].data(), lengths[c]) && ok;
+    }
+    return ok;
+}
+
+void LammpsDumpSink::flush() {
+    file.flush();
+}
+
+void LammpsDumpSink::close() {
+    if (file.isOpen()) {
+        file.close();
+    }
+}
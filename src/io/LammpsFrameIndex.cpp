@@ -0,0 +1,249 @@
+#include "LammpsFrameIndex.h"
+#include "MappedFile.h"
+#include "TextFormat.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <sys/stat.h>
+
+namespace {
+const char INDEX_MAGIC[8] = {'M', 'C', 'S', 'L', 'I', 'D', 'X', '\0'};
+const uint32_t INDEX_VERSION = 1;
+const char TIMESTEP_ITEM[] = "ITEM: TIMESTEP";
+const size_t MIN_BYTES_PER_THREAD = 16 << 20;
+
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t dumpSize;
+    int64_t dumpSeconds;
+    int64_t dumpNanoseconds;
+    uint64_t count;
+};
+
+bool statDump(const std::string& dumpFile, uint64_t& size, int64_t& seconds, int64_t& nanoseconds) {
+    struct stat info;
+    if (stat(dumpFile.c_str(), &info) != 0) {
+        return false;
+    }
+    size = static_cast<uint64_t>(info.st_size);
+    seconds = info.st_mtim.tv_sec;
+    nanoseconds = info.st_mtim.tv_nsec;
+    return true;
+}
+
+// Step on the line after the ITEM: TIMESTEP line at p, -1 if there is none
+int64_t parseStep(const char* p, const char* fileEnd) {
+    const char* stepLine = static_cast<const char*>(std::memchr(p, '\n', fileEnd - p));
+    double step = -1.0;
+    if (stepLine != nullptr) {
+        const char* stepEnd = static_cast<const char*>(std::memchr(stepLine + 1, '\n', fileEnd - stepLine - 1));
+        parseDouble(stepLine + 1, stepEnd != nullptr ? stepEnd : fileEnd, step);
+    }
+    return static_cast<int64_t>(step);
+}
+
+// Frames whose ITEM: TIMESTEP line starts in [begin, end), with the step from the following line
+void scanRange(const char* data, const char* begin, const char* end, const char* fileEnd,
+               std::vector<uint64_t>& offsets, std::vector<int64_t>& steps) {
+    for (const char* p = findLammpsTimestep(data, begin, fileEnd); p < end;
+         p = findLammpsTimestep(data, p + 1, fileEnd)) {
+        offsets.push_back(static_cast<uint64_t>(p - data));
+        steps.push_back(parseStep(p, fileEnd));
+    }
+}
+}
+
+// Only ITEM lines contain an 'I', so searching for that one byte skips the
+// particle lines at memchr speed
+const char* findLammpsTimestep(const char* data, const char* p, const char* end) {
+    size_t length = sizeof(TIMESTEP_ITEM) - 1;
+    while (p < end && (p = static_cast<const char*>(std::memchr(p, 'I', end - p))) != nullptr) {
+        if ((p == data || p[-1] == '\n') && static_cast<size_t>(end - p) >= length &&
+            std::memcmp(p, TIMESTEP_ITEM, length) == 0) {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+LammpsFrameIndex::LammpsFrameIndex() : dumpSize(0), dumpSeconds(0), dumpNanoseconds(0) {}
+
+std::string LammpsFrameIndex::sidecarFilename(const std::string& dumpFile) {
+    return dumpFile + ".idx";
+}
+
+// An indexed frame the dump still has at its offset, with the same step
+bool LammpsFrameIndex::hasFrame(const char* data, const char* end, size_t frame) const {
+    uint64_t offset = offsets[frame];
+    return offset < static_cast<uint64_t>(end - data) && findLammpsTimestep(data, data + offset, end) == data + offset &&
+           parseStep(data + offset, end) == steps[frame];
+}
+
+// Each thread scans a contiguous byte range; a frame belongs to the range its
+// first byte falls in, so the per-thread lists concatenate in file order
+bool LammpsFrameIndex::scan(const std::string& dumpFile, uint64_t from) {
+    uint64_t size;
+    int64_t seconds, nanoseconds;
+    MappedFile file;
+    if (!statDump(dumpFile, size, seconds, nanoseconds) || !file.open(dumpFile)) {
+        return false;
+    }
+    const char* data = file.getData();
+    const char* end = file.getEnd();
+
+    // A dump truncated and rewritten can have a frame at the old offset by
+    // chance, so the first, middle and last kept frames must match as well
+    if (from > 0 && (from >= file.getSize() || findLammpsTimestep(data, data + from, end) != data + from ||
+                     (!offsets.empty() && (!hasFrame(data, end, 0) || !hasFrame(data, end, offsets.size() / 2) ||
+                                           !hasFrame(data, end, offsets.size() - 1))))) {
+        return false;  // Not the dump this index was built for
+    }
+    size_t bytes = file.getSize() - std::min<uint64_t>(from, file.getSize());
+    size_t numThreads = std::max<size_t>(1, std::thread::hardware_concurrency());
+    numThreads = std::max<size_t>(1, std::min(numThreads, bytes / MIN_BYTES_PER_THREAD));
+
+    std::vector<std::vector<uint64_t>> threadOffsets(numThreads);
+    std::vector<std::vector<int64_t>> threadSteps(numThreads);
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < numThreads; t++) {
+        const char* begin = end - bytes + bytes * t / numThreads;
+        const char* stop = end - bytes + bytes * (t + 1) / numThreads;
+        if (t == 0) {
+            scanRange(data, begin, stop, end, threadOffsets[0], threadSteps[0]);
+            continue;
+        }
+        workers.push_back(std::thread(scanRange, data, begin, stop, end, std::ref(threadOffsets[t]),
+                                      std::ref(threadSteps[t])));
+    }
+    for (size_t t = 0; t < workers.size(); t++) {
+        workers[t].join();
+    }
+
+    for (size_t t = 0; t < numThreads; t++) {
+        offsets.insert(offsets.end(), threadOffsets[t].begin(), threadOffsets[t].end());
+        steps.insert(steps.end(), threadSteps[t].begin(), threadSteps[t].end());
+    }
+    dumpSize = file.getSize();
+    dumpSeconds = seconds;
+    dumpNanoseconds = nanoseconds;
+    return true;
+}
+
+bool LammpsFrameIndex::build(const std::string& dumpFile) {
+    offsets.clear();
+    steps.clear();
+    return scan(dumpFile, 0);
+}
+
+bool LammpsFrameIndex::save(const std::string& indexFile) const {
+    IndexHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    header.version = INDEX_VERSION;
+    header.dumpSize = dumpSize;
+    header.dumpSeconds = dumpSeconds;
+    header.dumpNanoseconds = dumpNanoseconds;
+    header.count = offsets.size();
+
+    std::vector<uint64_t> entries(2 * offsets.size());
+    for (size_t f = 0; f < offsets.size(); f++) {
+        entries[2 * f] = offsets[f];
+        std::memcpy(&entries[2 * f + 1], &steps[f], sizeof(int64_t));
+    }
+    std::string temporary = indexFile + ".tmp";
+    std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file " << temporary << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(uint64_t));
+    file.close();
+    if (!file || std::rename(temporary.c_str(), indexFile.c_str()) != 0) {
+        std::cerr << "Error writing index " << indexFile << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool LammpsFrameIndex::load(const std::string& indexFile) {
+    std::ifstream file(indexFile, std::ios::binary);
+    IndexHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) != 0 || header.version != INDEX_VERSION) {
+        return false;
+    }
+    std::streampos start = file.tellg();
+    file.seekg(0, std::ios::end);
+    uint64_t available = static_cast<uint64_t>(file.tellg() - start) / (2 * sizeof(uint64_t));
+    file.seekg(start);
+    if (header.count > available) {
+        return false;
+    }
+    std::vector<uint64_t> entries(2 * header.count);
+    if (!file.read(reinterpret_cast<char*>(entries.data()), entries.size() * sizeof(uint64_t))) {
+        return false;
+    }
+    offsets.resize(header.count);
+    steps.resize(header.count);
+    for (size_t f = 0; f < header.count; f++) {
+        offsets[f] = entries[2 * f];
+        std::memcpy(&steps[f], &entries[2 * f + 1], sizeof(int64_t));
+    }
+    dumpSize = header.dumpSize;
+    dumpSeconds = header.dumpSeconds;
+    dumpNanoseconds = header.dumpNanoseconds;
+    return true;
+}
+
+bool LammpsFrameIndex::isCurrent(const std::string& dumpFile) const {
+    uint64_t size;
+    int64_t seconds, nanoseconds;
+    return statDump(dumpFile, size, seconds, nanoseconds) && size == dumpSize && seconds == dumpSeconds &&
+           nanoseconds == dumpNanoseconds;
+}
+
+bool LammpsFrameIndex::open(const std::string& dumpFile) {
+    std::string indexFile = sidecarFilename(dumpFile);
+    if (load(indexFile) && isCurrent(dumpFile)) {
+        return true;
+    }
+
+    // A dump is written in large buffers that need not end on a frame, so the
+    // last indexed frame, step line included, may have been cut short; it is
+    // scanned again along with everything appended after it
+    uint64_t size;
+    int64_t seconds, nanoseconds;
+    bool ok;
+    if (!offsets.empty() && statDump(dumpFile, size, seconds, nanoseconds) && size > dumpSize) {
+        uint64_t from = offsets.back();
+        offsets.pop_back();
+        steps.pop_back();
+        ok = scan(dumpFile, from) || build(dumpFile);
+    } else {
+        ok = build(dumpFile);
+    }
+    if (ok) {
+        save(indexFile);
+    }
+    return ok;
+}
+
+size_t LammpsFrameIndex::getFrameCount() const {
+    return offsets.size();
+}
+
+uint64_t LammpsFrameIndex::getOffset(size_t frame) const {
+    return offsets[frame];
+}
+
+int64_t LammpsFrameIndex::getStep(size_t frame) const {
+    return steps[frame];
+}
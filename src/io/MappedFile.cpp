@@ -0,0 +1,57 @@
+#include "MappedFile.h"
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile() : fd(-1), data(nullptr), size(0) {}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& filename, bool sequential) {
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size == 0) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        close();
+        return false;
+    }
+    size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping file " << filename << std::endl;
+        close();
+        return false;
+    }
+    data = static_cast<const char*>(mapping);
+    madvise(mapping, size, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data != nullptr) {
+        munmap(const_cast<char*>(data), size);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    size = 0;
+}
+
+const char* MappedFile::getData() const {
+    return data;
+}
+
+const char* MappedFile::getEnd() const {
+    return data + size;
+}
+
+size_t MappedFile::getSize() const {
+    return size;
+}
@@ -0,0 +1,221 @@
+#include "TextFormat.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+namespace {
+const double POWERS_OF_TEN[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+char* fallback(char* out, double value, int precision) {
+    return out + std::snprintf(out, 32, "%.*g", precision, value);
+}
+
+char* writeDigits(char* out, unsigned long long value, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        out[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    return out + count;
+}
+
+// %g with 1 <= precision <= 15. The significand is obtained with a single
+// correctly rounded multiply or divide by an exact power of ten; values whose
+// rounding could go either way are handed to snprintf so the output always
+// matches it exactly.
+char* formatSignificant(char* out, double value, int precision) {
+    if (value == 0.0) {
+        if (std::signbit(value)) {
+            *out++ = '-';
+        }
+        *out++ = '0';
+        return out;
+    }
+    if (!std::isfinite(value)) {
+        return fallback(out, value, precision);
+    }
+
+    char* start = out;
+    double magnitude = std::fabs(value);
+    int exponent = static_cast<int>(std::floor(std::log10(magnitude)));
+    unsigned long long significand = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        int shift = precision - 1 - exponent;
+        if (shift > 22 || shift < -22) {
+            return fallback(start, value, precision);
+        }
+        double scaled = shift >= 0 ? magnitude * POWERS_OF_TEN[shift] : magnitude / POWERS_OF_TEN[-shift];
+        double fraction = scaled - std::floor(scaled);
+        if (std::fabs(fraction - 0.5) < 1e-6) {
+            return fallback(start, value, precision);
+        }
+        significand = static_cast<unsigned long long>(std::floor(scaled + 0.5));
+        unsigned long long upper = static_cast<unsigned long long>(POWERS_OF_TEN[precision]);
+        unsigned long long lower = static_cast<unsigned long long>(POWERS_OF_TEN[precision - 1]);
+        if (significand >= upper) {
+            exponent++;      // log10 underestimated, or rounding carried into a new digit (9.9999996 -> 10)
+        } else if (significand < lower) {
+            exponent--;
+        } else {
+            break;
+        }
+        if (attempt == 1) {
+            return fallback(start, value, precision);
+        }
+    }
+    // %g drops trailing zeros of the significand
+    int digits = precision;
+    while (digits > 1 && significand % 10 == 0) {
+        significand /= 10;
+        digits--;
+    }
+
+    if (value < 0) {
+        *out++ = '-';
+    }
+    if (exponent < -4 || exponent >= precision) {
+        *out++ = static_cast<char>('0' + significand / static_cast<unsigned long long>(POWERS_OF_TEN[digits - 1]));
+        if (digits > 1) {
+            *out++ = '.';
+            out = writeDigits(out, significand % static_cast<unsigned long long>(POWERS_OF_TEN[digits - 1]), digits - 1);
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int absExponent = exponent < 0 ? -exponent : exponent;
+        out = writeDigits(out, absExponent, absExponent >= 100 ? 3 : 2);
+    } else if (exponent >= 0) {
+        int integerDigits = exponent + 1;
+        if (digits <= integerDigits) {
+            out = writeDigits(out, significand, digits);
+            for (int i = digits; i < integerDigits; i++) {
+                *out++ = '0';
+            }
+        } else {
+            unsigned long long divisor = static_cast<unsigned long long>(POWERS_OF_TEN[digits - integerDigits]);
+            out = writeDigits(out, significand / divisor, integerDigits);
+            *out++ = '.';
+            out = writeDigits(out, significand % divisor, digits - integerDigits);
+        }
+    } else {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = 0; i < -exponent - 1; i++) {
+            *out++ = '0';
+        }
+        out = writeDigits(out, significand, digits);
+    }
+    return out;
+}
+}
+
+char* formatGeneral(char* out, double value, int precision) {
+    if (precision > 0) {
+        return precision <= 15 ? formatSignificant(out, value, precision) : fallback(out, value, precision);
+    }
+
+    // Shortest round trip: 15 digits (trailing zeros trimmed) usually suffice
+    char* end = formatSignificant(out, value, 15);
+    char text[40];
+    size_t length = end - out;
+    std::memcpy(text, out, length);
+    text[length] = '\0';
+    if (std::strtod(text, nullptr) == value) {
+        return end;
+    }
+    return fallback(out, value, 17);
+}
+
+char* formatInteger(char* out, long long value) {
+    char digits[24];
+    int count = 0;
+    unsigned long long magnitude = value < 0 ? 0ull - static_cast<unsigned long long>(value) : value;
+    do {
+        digits[count++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    if (value < 0) {
+        *out++ = '-';
+    }
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+const char* parseDouble(const char* p, const char* end, double& value) {
+    while (p < end && (*p == ' ' || *p == '\t')) {
+        p++;
+    }
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Up to 19 significant digits fit the mantissa; any beyond make the fast path inexact
+    unsigned long long mantissa = 0;
+    int significant = 0;
+    int exponent = 0;
+    bool anyDigits = false;
+    bool truncated = false;
+    while (p < end && *p >= '0' && *p <= '9') {
+        anyDigits = true;
+        if (significant < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            significant += mantissa != 0;
+        } else {
+            exponent++;
+            truncated = true;
+        }
+        p++;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && *p >= '0' && *p <= '9') {
+            anyDigits = true;
+            if (significant < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                significant += mantissa != 0;
+                exponent--;
+            } else {
+                truncated = true;
+            }
+            p++;
+        }
+    }
+    if (!anyDigits) {
+        return nullptr;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negativeExponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negativeExponent = *q == '-';
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int written = 0;
+            while (q < end && *q >= '0' && *q <= '9') {
+                written = std::min(written * 10 + (*q - '0'), 100000);
+                q++;
+            }
+            exponent += negativeExponent ? -written : written;
+            p = q;
+        }
+    }
+
+    // Both the mantissa and the power of ten are exact, so one operation rounds correctly
+    if (!truncated && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double magnitude = static_cast<double>(mantissa);
+        magnitude = exponent < 0 ? magnitude / POWERS_OF_TEN[-exponent] : magnitude * POWERS_OF_TEN[exponent];
+        value = negative ? -magnitude : magnitude;
+        return p;
+    }
+    std::string token(start, p);
+    value = std::strtod(token.c_str(), nullptr);
+    return p;
+}
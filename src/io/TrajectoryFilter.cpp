@@ -0,0 +1,122 @@
+#include "TrajectoryFilter.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+TrajectoryFilter::TrajectoryFilter() : stride(1), regionEnabled(false), candidateCount(0), candidatesStale(true) {
+    for (int axis = 0; axis < 3; axis++) {
+        regionLow[axis] = 0.0;
+        regionHigh[axis] = 0.0;
+    }
+}
+
+void TrajectoryFilter::addIndexRange(size_t begin, size_t end) {
+    indexRanges.push_back(std::make_pair(begin, end));
+    candidatesStale = true;
+}
+
+void TrajectoryFilter::setStride(size_t every) {
+    stride = std::max<size_t>(1, every);
+    candidatesStale = true;
+}
+
+void TrajectoryFilter::setTypes(const std::vector<int>& particleTypes) {
+    types = particleTypes;
+    candidatesStale = true;
+}
+
+bool TrajectoryFilter::loadTypes(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    std::vector<int> particleTypes;
+    int type;
+    while (file >> type) {
+        particleTypes.push_back(type);
+    }
+    if (!file.eof()) {
+        std::cerr << "Type table " << filename << " has a non-integer entry after " << particleTypes.size()
+                  << " particles" << std::endl;
+        return false;
+    }
+    setTypes(particleTypes);
+    return true;
+}
+
+void TrajectoryFilter::setKeptTypes(const std::vector<int>& kept) {
+    keepTypes = kept;
+    candidatesStale = true;
+}
+
+void TrajectoryFilter::setRegion(const double low[3], const double high[3]) {
+    for (int axis = 0; axis < 3; axis++) {
+        regionLow[axis] = low[axis];
+        regionHigh[axis] = high[axis];
+    }
+    regionEnabled = true;
+}
+
+void TrajectoryFilter::clear() {
+    *this = TrajectoryFilter();
+}
+
+bool TrajectoryFilter::selectsIndices() const {
+    return !indexRanges.empty() || stride > 1 || !keepTypes.empty();
+}
+
+bool TrajectoryFilter::isActive() const {
+    return selectsIndices() || regionEnabled;
+}
+
+bool TrajectoryFilter::hasRegion() const {
+    return regionEnabled;
+}
+
+bool TrajectoryFilter::keepsIndex(size_t index) const {
+    if (index % stride != 0) {
+        return false;
+    }
+    if (!keepTypes.empty()) {
+        int type = index < types.size() ? types[index] : 1;
+        if (std::find(keepTypes.begin(), keepTypes.end(), type) == keepTypes.end()) {
+            return false;
+        }
+    }
+    if (indexRanges.empty()) {
+        return true;
+    }
+    for (size_t r = 0; r < indexRanges.size(); r++) {
+        if (index >= indexRanges[r].first && index < indexRanges[r].second) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void TrajectoryFilter::apply(const BoxSnapshot& snapshot, std::vector<Particle>& particles, std::vector<uint32_t>& ids) {
+    size_t count = snapshot.getParticleCount();
+    if (candidatesStale || candidateCount != count) {
+        candidates.clear();
+        for (size_t i = 0; i < count; i++) {
+            if (!selectsIndices() || keepsIndex(i)) {
+                candidates.push_back(static_cast<uint32_t>(i));
+            }
+        }
+        candidateCount = count;
+        candidatesStale = false;
+    }
+
+    particles.clear();
+    ids.clear();
+    for (size_t c = 0; c < candidates.size(); c++) {
+        const Particle& p = snapshot.getParticle(candidates[c]);
+        if (regionEnabled && !(p.x >= regionLow[0] && p.x < regionHigh[0] && p.y >= regionLow[1] &&
+                               p.y < regionHigh[1] && p.z >= regionLow[2] && p.z < regionHigh[2])) {
+            continue;
+        }
+        particles.push_back(p);
+        ids.push_back(candidates[c]);
+    }
+}
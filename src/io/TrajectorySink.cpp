@@ -0,0 +1,24 @@
+#include "TrajectorySink.h"
+#include "BinaryTrajectory.h"
+#include "CompressedTrajectory.h"
+#include "MoveLog.h"
+
+namespace {
+bool hasExtension(const std::string& filename, const std::string& extension) {
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+}
+
+TrajectorySink* createTrajectorySink(const std::string& filename, const TrajectoryOptions& options) {
+    if (hasExtension(filename, ".mctraj")) {
+        return new BinaryTrajectorySink(8, options.seed);
+    }
+    if (hasExtension(filename, ".mcz")) {
+        return new CompressedTrajectorySink(options.compressionPrecision, options.keyframeInterval, options.seed);
+    }
+    if (hasExtension(filename, ".mclog")) {
+        return new MoveLogSink(options.seed);
+    }
+    return new LammpsDumpSink(false, options.textPrecision);
+}
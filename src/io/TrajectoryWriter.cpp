@@ -0,0 +1,216 @@
+#include "TrajectoryWriter.h"
+#include <chrono>
+#include <iostream>
+
+TrajectoryWriter::TrajectoryWriter(size_t queueFrames)
+    : stopRequested(false), filled(queueFrames), available(queueFrames), queuedFrames(0), takenFrames(0),
+      backlogFrame(0), writtenFrames(0), droppedFrames(0) {
+    slots.resize(filled.capacity());
+}
+
+TrajectoryWriter::~TrajectoryWriter() {
+    close();
+}
+
+bool TrajectoryWriter::open(const std::string& path, double boxSize, TrajectorySink* format,
+                            const TrajectoryFilter& outputFilter) {
+    close();
+    filter = outputFilter;
+    sink.reset(format ? format : new LammpsDumpSink());
+    if (filter.hasRegion() && sink->hasFixedParticleCount()) {
+        std::cerr << "A region filter changes the particle count from frame to frame, which " << path
+                  << " cannot store; use a LAMMPS dump" << std::endl;
+        sink.reset();
+        return false;
+    }
+    if (filter.isActive() && sink->acceptsMoves()) {
+        std::cerr << "A move log records every particle, so " << path << " cannot be filtered; clear the output filter"
+                  << std::endl;
+        sink.reset();
+        return false;
+    }
+    if (!sink->open(path, boxSize)) {
+        sink.reset();
+        return false;
+    }
+    filename = path;
+
+    size_t slot;
+    while (available.pop(slot)) {
+    }
+    for (size_t s = 0; s < slots.size(); s++) {
+        available.push(s);
+    }
+    queuedFrames = 0;
+    takenFrames = 0;
+    backlogFrame = 0;
+    writtenFrames = 0;
+    droppedFrames = 0;
+    stopRequested = false;
+    worker = std::thread(&TrajectoryWriter::writeLoop, this);
+    return true;
+}
+
+void TrajectoryWriter::close() {
+    if (worker.joinable()) {
+        stopRequested = true;
+        worker.join();
+    }
+    if (sink) {
+        sink->close();
+        sink.reset();
+    }
+    filename.clear();
+}
+
+bool TrajectoryWriter::isOpen() const {
+    return sink != nullptr;
+}
+
+const std::string& TrajectoryWriter::getFilename() const {
+    return filename;
+}
+
+bool TrajectoryWriter::acceptsMoves() const {
+    return sink && sink->acceptsMoves();
+}
+
+// Only the chunk references are taken here; assembling, formatting and I/O happen on the writer thread
+bool TrajectoryWriter::submit(const BoxSnapshot& snapshot) {
+    size_t slot;
+    if (!sink) {
+        return false;
+    }
+    if (!available.pop(slot)) {
+        droppedFrames++;
+        return false;
+    }
+    slots[slot] = snapshot;
+    filled.push(slot);
+    queuedFrames++;
+    return true;
+}
+
+bool TrajectoryWriter::submit(const std::shared_ptr<const HistoryBacklog>& backlog) {
+    if (!sink) {
+        return false;
+    }
+    Backlog entry = {queuedFrames, backlog, nullptr};
+    std::lock_guard<std::mutex> lock(backlogMutex);
+    backlogs.push_back(entry);
+    return true;
+}
+
+bool TrajectoryWriter::submit(const std::shared_ptr<const std::vector<MoveLogSegment>>& segments) {
+    if (!acceptsMoves()) {
+        return false;
+    }
+    Backlog entry = {queuedFrames, nullptr, segments};
+    std::lock_guard<std::mutex> lock(backlogMutex);
+    backlogs.push_back(entry);
+    return true;
+}
+
+void TrajectoryWriter::writeFrame(const BoxSnapshot& snapshot) {
+    Frame frame;
+    if (filter.isActive()) {
+        filter.apply(snapshot, frameBuffer, frameIds);
+        frame.ids = frameIds.data();
+    } else {
+        frameBuffer.resize(snapshot.getParticleCount());
+        snapshot.copyTo(frameBuffer.data());
+    }
+    frame.step = snapshot.getStep();
+    frame.particles = frameBuffer.data();
+    frame.count = frameBuffer.size();
+    if (sink->write(frame)) {
+        writtenFrames++;
+    } else {
+        droppedFrames++;
+    }
+}
+
+// The moves first, then the keyframe they lead up to, if the segment has one
+void TrajectoryWriter::writeSegment(const MoveLogSegment& segment) {
+    bool hasKeyframe = segment.keyframe.getParticleCount() > 0;
+    if ((!segment.events.empty() || !hasKeyframe) &&
+        !sink->writeMoves(segment.events.data(), segment.events.size(), segment.lastStep)) {
+        std::cerr << "Could not write the moves up to step " << segment.lastStep << std::endl;
+    }
+    if (hasKeyframe) {
+        writeFrame(segment.keyframe);
+    }
+}
+
+// One frame or segment at a time, so the lock is never held across formatting or I/O
+bool TrajectoryWriter::writeBacklogFrame() {
+    std::shared_ptr<const HistoryBacklog> frames;
+    std::shared_ptr<const std::vector<MoveLogSegment>> moves;
+    {
+        std::lock_guard<std::mutex> lock(backlogMutex);
+        if (backlogs.empty() || backlogs.front().position > takenFrames) {
+            return false;
+        }
+        const Backlog& front = backlogs.front();
+        if (backlogFrame == (front.frames ? front.frames->size() : front.moves->size())) {
+            backlogs.pop_front();
+            backlogFrame = 0;
+            return true;
+        }
+        frames = front.frames;
+        moves = front.moves;
+    }
+    if (moves) {
+        writeSegment((*moves)[backlogFrame++]);
+        return true;
+    }
+    BoxSnapshot snapshot;
+    if (frames->getFrame(backlogFrame, snapshot)) {
+        writeFrame(snapshot);
+    } else {
+        std::cerr << "Could not read history frame at step " << frames->getStep(backlogFrame) << std::endl;
+        droppedFrames++;
+    }
+    backlogFrame++;
+    return true;
+}
+
+// Drain the queue and any backlog due, flush whenever both run dry so the
+// file stays current, and exit only once a stop was requested and nothing is left
+void TrajectoryWriter::writeLoop() {
+    bool unflushed = false;
+    while (true) {
+        if (writeBacklogFrame()) {
+            unflushed = true;
+            continue;
+        }
+        size_t slot;
+        if (filled.pop(slot)) {
+            takenFrames++;
+            writeFrame(slots[slot]);
+            slots[slot].clear();  // Release the chunks before the slot goes back
+            available.push(slot);
+            unflushed = true;
+            continue;
+        }
+        if (unflushed) {
+            sink->flush();
+            unflushed = false;
+        }
+        if (stopRequested && filled.empty()) {
+            std::lock_guard<std::mutex> lock(backlogMutex);
+            if (backlogs.empty()) {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+long long TrajectoryWriter::getWrittenFrames() const {
+    return writtenFrames;
+}
+
+long long TrajectoryWriter::getDroppedFrames() const {
+    return droppedFrames;
+}
@@ -1,7 +1,15 @@
 #include "include/glad/glad.h"
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
 #include "Simulation.h"
+#include "SimulationEngine.h"
 #include "Renderer.h"
 #include "../imgui/imgui.h"
 #include "../imgui/backends/imgui_impl_glfw.h"
@@ -95,13 +103,28 @@ int main() {
 
     Simulation simulation(100, 10000, 1.0, 10.0);
     simulation.initialize();
+    Simulation::installCheckpointSignalHandler();
 
     char filename[128] = "particles.dump";
+    char checkpointFilename[128] = "simulation.mcchk";
+    int checkpointInterval = 0;
+    char stateFilename[128] = "simulation.mcstate";
+    int stateSyncInterval = 10000;
     int intervalSteps = 10;
-    bool isRunning = false;  // Toggle for simulation
+    int historyFrames = 1000;
+    int historyMegabytes = 0;  // RAM budget for the history, 0 to count frames instead
+    char spillDirectory[128] = "/tmp";
+    simulation.setCheckpoint(checkpointFilename, checkpointInterval);
+
+    // From here on the simulation runs on the engine thread; the UI posts commands and draws published frames
+    SimulationEngine engine(simulation);
+    uint64_t reloadTicket = 0;  // Command after which the inputs are refreshed from the simulation
+    const DirtyRanges noChanges;  // A frame already drawn is drawn again unchanged
 
     while (!glfwWindowShouldClose(window)) {
         glfwPollEvents();
+        bool freshFrame = engine.update();
+        const EngineFrame& frame = engine.getFrame();
 
         ImGui_ImplOpenGL3_NewFrame();
         ImGui_ImplGlfw_NewFrame();
@@ -113,39 +136,312 @@ int main() {
         // Control panel
         ImGui::Begin("Monte Carlo Simulation");
 
-        static int numParticles = simulation.getNumParticles();
-        static int numSteps = simulation.getNumSteps();
-        static double temperature = simulation.getTemperature();
+        static int numParticles = frame.numParticles;
+        static int numSteps = frame.numSteps;
+        static double temperature = frame.temperature;
+        if (reloadTicket != 0 && frame.commandsDone >= reloadTicket) {
+            numParticles = frame.numParticles;
+            numSteps = frame.numSteps;
+            temperature = frame.temperature;
+            reloadTicket = 0;
+        }
 
         ImGui::InputInt("Number of Particles", &numParticles);
         ImGui::InputInt("Number of Steps", &numSteps);
         ImGui::InputDouble("Temperature", &temperature);
         ImGui::InputInt("Interval of Steps", &intervalSteps);
+        ImGui::InputInt("History Frames", &historyFrames);
+        ImGui::InputInt("History RAM (MB, 0 = frames)", &historyMegabytes);
+        static bool quantiseHistory = false;
+        ImGui::Checkbox("Quantise History (16-bit)", &quantiseHistory);
         ImGui::InputText("Filename", filename, IM_ARRAYSIZE(filename));
 
+        // Run settings shared by both ways of starting a run
+        int steps = numSteps;
+        double runTemperature = temperature;
+        int interval = intervalSteps;
+        size_t frames = historyFrames > 0 ? historyFrames : 1;
+        size_t historyBytes = static_cast<size_t>(std::max(0, historyMegabytes)) << 20;
+        bool quantise = quantiseHistory;
+        std::function<void(Simulation&)> applyRunSettings = [=](Simulation& s) {
+            s.setNumSteps(steps);
+            s.setTemperature(runTemperature);
+            s.setIntervalSteps(interval);
+            s.setHistoryFrames(frames);
+            if (historyBytes > 0) {
+                s.setHistoryBytes(historyBytes);
+            }
+            s.setHistoryQuantised(quantise);
+        };
+
         if (ImGui::Button("Initialize")) {
-            simulation.setNumParticles(numParticles);
-            simulation.setNumSteps(numSteps);
-            simulation.setTemperature(temperature);
-            simulation.setIntervalSteps(intervalSteps);
-            simulation.initialize();
+            int particles = numParticles;
+            engine.post([=](Simulation& s) {
+                s.setNumParticles(particles);
+                applyRunSettings(s);
+                s.initialize();
+            });
         }
 
-        if (ImGui::Button(isRunning ? "Pause Simulation" : "Run Simulation")) {
-            isRunning = !isRunning;
+        // Start from a frame of an existing trajectory (LAMMPS dump, .xyz, .mctraj or .mcz) instead
+        static int loadFrame = -1;
+        ImGui::InputInt("Frame (-1 = last)", &loadFrame);
+        if (ImGui::Button("Load Configuration")) {
+            std::string source = filename;
+            long long sourceFrame = loadFrame;
+            reloadTicket = engine.post([=](Simulation& s) {
+                applyRunSettings(s);
+                s.initializeFromFile(source, sourceFrame);
+            });
+        }
+
+        // Running goes on to the number of steps in the panel, so a finished run can be extended
+        if (ImGui::Button(frame.running ? "Pause Simulation" : "Run Simulation")) {
+            if (!frame.running) {
+                engine.post([steps](Simulation& s) { s.setNumSteps(steps); });
+            }
+            engine.setRunning(!frame.running);
+        }
+        if (frame.running) {
+            ImGui::SameLine();
+            ImGui::Text("%.0f steps/s", frame.stepsPerSecond);
+        } else if (frame.step >= frame.numSteps) {
+            ImGui::SameLine();
+            ImGui::Text("Finished: raise the number of steps and run again to continue");
         }
 
         if (ImGui::Button("Save Dump")) {
-            simulation.saveParticles(filename);
+            std::string target = filename;
+            engine.post([=](Simulation& s) { s.saveParticles(target); });
+        }
+        if (frame.writerOpen) {
+            ImGui::SameLine();
+            if (ImGui::Button("Stop Dump")) {
+                engine.post([](Simulation& s) { s.stopSaving(); });
+            }
+            ImGui::Text("Streaming to %s: %lld frames written, %lld dropped", frame.writerFilename.c_str(),
+                        frame.writtenFrames, frame.droppedFrames);
         }
 
-        ImGui::End();
+        // Frames are saved every interval, once per energy decorrelation time, or when an observable has moved enough
+        static int saveMode = Simulation::FIXED_INTERVAL;
+        static int saveQuantity = Observables::ENERGY;
+        static double saveThreshold = 0.1;
+        bool saveModeChanged = ImGui::Combo("Save Frames", &saveMode, "Every interval\0Per decorrelation time\0On observable change\0");
+        if (saveMode == Simulation::OBSERVABLE_CHANGE) {
+            saveModeChanged |= ImGui::Combo("Observable", &saveQuantity, "Energy per particle\0Virial per particle\0Pressure\0");
+            saveModeChanged |= ImGui::InputDouble("Change Threshold", &saveThreshold);
+        }
+        if (saveModeChanged) {
+            Simulation::SaveMode mode = static_cast<Simulation::SaveMode>(saveMode);
+            Observables::Quantity quantity = saveMode == Simulation::DECORRELATION
+                                                 ? Observables::ENERGY
+                                                 : static_cast<Observables::Quantity>(saveQuantity);
+            double threshold = saveThreshold;
+            engine.post([=](Simulation& s) { s.setSaveMode(mode, quantity, threshold); });
+        }
+        if (saveMode == Simulation::DECORRELATION) {
+            ImGui::Text("Saving every %d steps", frame.saveInterval);
+        }
 
-        // Render particles and update simulation
-        if (isRunning) {
-            simulation.run(1);  // Run one simulation step
+        // Output filter, used for the next file "Save Dump" opens
+        if (ImGui::CollapsingHeader("Output Filter")) {
+            static int stride = 1;
+            static int firstIndex = 0;
+            static int lastIndex = -1;  // Exclusive, -1 for no limit
+            static bool slab = false;
+            static float slabLow = 0.0f;
+            static float slabHigh = 1.0f;
+            static char typeTable[128] = "";
+            static char keptTypes[64] = "";
+            ImGui::InputInt("Every nth Particle", &stride);
+            ImGui::InputInt("First Index", &firstIndex);
+            ImGui::InputInt("End Index (-1 = all)", &lastIndex);
+            ImGui::Checkbox("Slab in z", &slab);
+            if (slab) {
+                ImGui::InputFloat("z from", &slabLow);
+                ImGui::InputFloat("z to", &slabHigh);
+                ImGui::Text("LAMMPS dumps only: the count varies per frame");
+            }
+            ImGui::InputText("Type Table", typeTable, IM_ARRAYSIZE(typeTable));
+            ImGui::InputText("Kept Types (e.g. 1 3)", keptTypes, IM_ARRAYSIZE(keptTypes));
+            if (ImGui::Button("Apply Filter")) {
+                std::vector<int> kept;
+                std::istringstream types(keptTypes);
+                int type;
+                while (types >> type) {
+                    kept.push_back(type);
+                }
+                int everyNth = stride > 0 ? stride : 1;
+                int first = std::max(0, firstIndex);
+                int end = lastIndex >= 0 ? lastIndex : INT_MAX;
+                bool limited = firstIndex > 0 || lastIndex >= 0;
+                bool inSlab = slab;
+                double low = slabLow;
+                double high = slabHigh;
+                std::string table = typeTable;
+                engine.post([=](Simulation& s) {
+                    TrajectoryFilter& filter = s.getTrajectoryOptions().filter;
+                    filter.clear();
+                    filter.setStride(everyNth);
+                    if (limited) {
+                        filter.addIndexRange(first, end);
+                    }
+                    if (inSlab) {
+                        double size = s.getBox().getSize();
+                        double lowCorner[3] = {0.0, 0.0, low};
+                        double highCorner[3] = {size, size, high};
+                        filter.setRegion(lowCorner, highCorner);
+                    }
+                    if (!table.empty()) {
+                        filter.loadTypes(table);
+                    }
+                    filter.setKeptTypes(kept);
+                });
+            }
         }
 
+        // Frames pushed out of the RAM budget go to a scratch file instead of being dropped
+        ImGui::InputText("Spill Directory", spillDirectory, IM_ARRAYSIZE(spillDirectory));
+        bool spillHistory = frame.historySpilling;
+        if (ImGui::Checkbox("Spill History to Disk", &spillHistory)) {
+            std::string directory = spillHistory ? spillDirectory : "";
+            engine.post([=](Simulation& s) { s.setHistorySpill(directory); });
+        }
+        if (spillHistory) {
+            ImGui::Text("History: %zu frames in memory, %zu on disk (%.1f MB)", frame.historySize - frame.spilledFrames,
+                        frame.spilledFrames, frame.spilledBytes / 1048576.0);
+        }
+
+        // Scrub back through the history; the live configuration is shown at the right end.
+        // The engine fetches the selected frame, from disk if it was spilled.
+        static int historyIndex = -1;
+        int lastFrame = static_cast<int>(frame.historySize) - 1;
+        if (historyIndex < 0 || historyIndex > lastFrame) {
+            historyIndex = lastFrame;
+        }
+        static bool showLive = true;
+        bool viewChanged = ImGui::Checkbox("Live", &showLive);
+        if (!showLive && lastFrame >= 0) {
+            viewChanged |= ImGui::SliderInt("History Frame", &historyIndex, 0, lastFrame);
+            ImGui::Text("Showing step %d", frame.historyStep);
+        }
+        if (viewChanged) {
+            engine.showHistoryFrame(showLive ? -1 : historyIndex);
+        }
+
+        // While recording, every accepted move and periodic keyframes replace the saved frames: the
+        // history and a dump get the keyframes, a .mclog file everything. Unticking stops it but keeps
+        // what was recorded for saving.
+        bool recordMoves = frame.moveLogEnabled;
+        static int keyframeInterval = 1000;
+        if (ImGui::Checkbox("Record Moves (save as .mclog)", &recordMoves)) {
+            int interval = std::max(1, keyframeInterval);
+            engine.post([=](Simulation& s) { s.setMoveLogEnabled(recordMoves, interval); });
+        }
+        ImGui::InputInt("Keyframe Interval (steps)", &keyframeInterval);
+        static int moveLogMegabytes = static_cast<int>(MoveLog::DEFAULT_MEMORY_LIMIT >> 20);
+        if (ImGui::InputInt("Move Log RAM (MB, oldest dropped)", &moveLogMegabytes)) {
+            size_t limit = static_cast<size_t>(std::max(1, moveLogMegabytes)) << 20;
+            engine.post([=](Simulation& s) { s.setMoveLogMemoryLimit(limit); });
+        }
+        if (frame.moveLogKeyframes > 0) {
+            ImGui::Text("Move log%s: steps %d to %d, %zu moves, %zu keyframes, %.1f MB",
+                        recordMoves ? "" : " (stopped)", frame.moveLogFirstStep, frame.moveLogLastStep,
+                        frame.moveLogEvents, frame.moveLogKeyframes, frame.moveLogBytes / 1048576.0);
+        }
+
+        // Checkpoints are also written every interval steps (0 disables) and on SIGUSR1
+        bool checkpointChanged = ImGui::InputText("Checkpoint", checkpointFilename, IM_ARRAYSIZE(checkpointFilename));
+        if (ImGui::InputInt("Checkpoint Interval", &checkpointInterval)) {
+            checkpointInterval = std::max(0, checkpointInterval);
+            checkpointChanged = true;
+        }
+        if (checkpointChanged) {
+            std::string target = checkpointFilename;
+            int every = checkpointInterval;
+            engine.post([=](Simulation& s) { s.setCheckpoint(target, every); });
+        }
+        if (ImGui::Button("Save Checkpoint")) {
+            engine.post([](Simulation& s) { s.checkpoint(); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Load Checkpoint")) {
+            std::string source = checkpointFilename;
+            reloadTicket = engine.post([=](Simulation& s) { s.loadCheckpoint(source); });
+        }
+        bool forkCheckpoints = frame.checkpointForking;
+        if (ImGui::Checkbox("Fork Checkpoints", &forkCheckpoints)) {
+            engine.post([=](Simulation& s) { s.setCheckpointForking(forkCheckpoints); });
+        }
+        const CheckpointStats& checkpoints = frame.checkpoints;
+        if (checkpoints.completed + checkpoints.failed + checkpoints.skipped > 0) {
+            ImGui::Text("Checkpoints: %lld written, %lld failed, %lld skipped, %d in progress",
+                        checkpoints.completed, checkpoints.failed, checkpoints.skipped, checkpoints.activeChildren);
+            ImGui::Text("Pause %.2f ms (max %.2f), latency %.2f ms (max %.2f)", checkpoints.lastPauseMs,
+                        checkpoints.maxPauseMs, checkpoints.lastLatencyMs, checkpoints.maxLatencyMs);
+        }
+
+        // Live positions in a memory-mapped file, synced every interval steps (0 only on exit)
+        ImGui::InputText("State File", stateFilename, IM_ARRAYSIZE(stateFilename));
+        if (ImGui::InputInt("State Sync Interval", &stateSyncInterval)) {
+            stateSyncInterval = std::max(0, stateSyncInterval);
+        }
+        bool keepState = frame.stateFile;
+        std::string stateTarget = stateFilename;
+        int syncInterval = stateSyncInterval;
+        if (ImGui::Checkbox("Keep State in File", &keepState)) {
+            std::string target = keepState ? stateTarget : "";
+            engine.post([=](Simulation& s) { s.setStateFile(target, syncInterval); });
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("Restore State")) {
+            reloadTicket = engine.post([=](Simulation& s) { s.restoreStateFile(stateTarget, syncInterval); });
+        }
+
+        // Thermodynamic observables averaged since the last initialization
+        ImGui::Separator();
+        ImGui::Text("Step: %d", frame.step);
+        ImGui::Text("Energy per particle: %.4f", frame.energyPerParticle);
+        ImGui::Text("Pressure: %.4f +/- %.4f", frame.pressure, frame.pressureError);
+        ImGui::Text("Heat capacity (excess): %.4f", frame.heatCapacity);
+        ImGui::Text("Compressibility factor: %.4f", frame.compressibility);
+        if (frame.equilibrated) {
+            ImGui::Text("Equilibrated, burn-in %lld steps, tau %.1f steps", frame.burnIn, frame.autocorrelationTime);
+        } else {
+            ImGui::Text("Equilibrating...");
+        }
+
+        // The engine pauses itself once the energy is known to the requested standard error
+        static double targetError = 0.0;
+        if (ImGui::InputDouble("Target energy error", &targetError)) {
+            double error = targetError;
+            engine.post([=](Simulation& s) { s.setStoppingRule(Observables::ENERGY, error); });
+        }
+        if (frame.targetReached) {
+            ImGui::Text("Target error reached");
+        }
+
+        // Live radial distribution function
+        ImGui::Text("g(r), r up to %.2f (%lld samples)", frame.rdfMaxRadius, frame.rdfSamples);
+        ImGui::PlotLines("##gofr", frame.gofr.data(), static_cast<int>(frame.gofr.size()), 0, NULL, 0.0f, FLT_MAX,
+                         ImVec2(0, 120));
+
+        // Static structure factor, updated per accepted move while enabled
+        bool structureFactorEnabled = frame.structureFactorEnabled;
+        if (ImGui::Checkbox("Structure factor S(k)", &structureFactorEnabled)) {
+            engine.post([=](Simulation& s) { s.setStructureFactorEnabled(structureFactorEnabled); });
+        }
+        if (structureFactorEnabled) {
+            if (!frame.kValues.empty()) {
+                ImGui::Text("S(k), k from %.2f to %.2f", frame.kValues.front(), frame.kValues.back());
+            }
+            ImGui::PlotLines("##sofk", frame.sofk.data(), static_cast<int>(frame.sofk.size()), 0, NULL, 0.0f, FLT_MAX,
+                             ImVec2(0, 120));
+        }
+
+        ImGui::End();
+
         // OpenGL rendering
         ImGui::Render();
         int display_w, display_h;
@@ -156,12 +452,20 @@ int main() {
 
 
 
-        renderParticles(simulation.getBox());  // Render current particle states
+        // Quantised history frames are drawn without decoding them first
+        if (showLive || frame.historyIndex < 0) {
+            renderParticles(frame.live, freshFrame ? frame.liveChanges : noChanges);  // Only changed particles are uploaded
+        } else if (frame.historyQuantised) {
+            renderParticles(*frame.historyQuantised);
+        } else {
+            renderParticles(frame.history);
+        }
 
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
         glfwSwapBuffers(window);
     }
 
+    releaseRenderer();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
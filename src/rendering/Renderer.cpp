@@ -1,21 +1,380 @@
 #include "Renderer.h"
 #include "glad/glad.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+namespace {
+// Positions arrive in box or fixed-point units and are mapped to [-1, 1] as
+// position * scale + offset. Each point is drawn as a sprite shaded like a
+// sphere lit from the upper left, darker the further back it is.
+const char* VERTEX_SHADER = R"(#version 130
+in vec3 position;
+uniform float scale;
+uniform float offset;
+uniform float pointSize;
+out float depth;
+void main() {
+    vec3 ndc = position * scale + offset;
+    depth = ndc.z * 0.5 + 0.5;
+    gl_Position = vec4(ndc, 1.0);
+    gl_PointSize = pointSize;
+}
+)";
+
+const char* FRAGMENT_SHADER = R"(#version 130
+in float depth;
+void main() {
+    vec2 p = gl_PointCoord * 2.0 - 1.0;
+    float r2 = dot(p, p);
+    if (r2 > 1.0) {
+        discard;
+    }
+    vec3 normal = vec3(p.x, -p.y, sqrt(1.0 - r2));
+    float light = 0.35 + 0.65 * max(dot(normal, normalize(vec3(-0.4, 0.5, 0.8))), 0.0);
+    gl_FragColor = vec4(vec3(1.0, 0.5, 0.0) * light * (1.0 - 0.35 * depth), 1.0);
+}
+)";
+
+const float POINT_SIZE = 5.0f;
+const unsigned REGIONS = 3;              // Persistent buffer regions, so the GPU reads one while the next is filled
+const size_t MIN_REGION_BYTES = 1 << 20;
+const size_t FULL_UPLOAD_DIVISOR = 4;    // Above a quarter of the particles changed, one copy of all beats many small ones
+const size_t MAX_PARTIAL_RANGES = 4096;  // Each range is a separate glBufferSubData without persistent mapping
+
+// GPU side of the particle drawing. With GL 4.4 the vertex buffer is mapped
+// once, persistently, and each frame writes its positions straight into the
+// next of REGIONS regions, waiting on that region's fence from three frames
+// ago. Older contexts fill a staging array and hand it to glBufferSubData.
+//
+// A region that last held the live configuration keeps it, so the next live
+// frame only rewrites the particles changed since; each region collects the
+// changes it has missed in livePending until it is reused. Without persistent
+// mapping there is one region, and staging mirrors the buffer.
+struct ParticleBuffer {
+    bool ready;
+    bool failed;          // Shaders did not build; nothing is drawn
+    GLuint program;
+    GLuint vao;
+    GLuint vbo;
+    GLint positionLocation;
+    GLint scaleLocation;
+    GLint offsetLocation;
+    GLint pointSizeLocation;
+    bool persistent;
+    char* mapped;
+    size_t regionBytes;
+    unsigned region;      // Region of the current frame
+    GLsync fences[REGIONS];
+    std::vector<char> staging;
+    bool liveValid[REGIONS];          // Region holds the live configuration, apart from livePending
+    DirtyRanges livePending[REGIONS];
+    size_t liveCount;
+};
+
+ParticleBuffer buffer;
+
+GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, nullptr);
+    glCompileShader(shader);
+    GLint ok = GL_FALSE;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        std::cerr << "Error compiling particle shader: " << log << std::endl;
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool buildProgram() {
+    GLuint vertex = compileShader(GL_VERTEX_SHADER, VERTEX_SHADER);
+    GLuint fragment = compileShader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER);
+    if (vertex == 0 || fragment == 0) {
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return false;
+    }
+    buffer.program = glCreateProgram();
+    glAttachShader(buffer.program, vertex);
+    glAttachShader(buffer.program, fragment);
+    glLinkProgram(buffer.program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+    GLint ok = GL_FALSE;
+    glGetProgramiv(buffer.program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        glGetProgramInfoLog(buffer.program, sizeof(log), nullptr, log);
+        std::cerr << "Error linking particle shader: " << log << std::endl;
+        glDeleteProgram(buffer.program);
+        buffer.program = 0;
+        return false;
+    }
+    buffer.positionLocation = glGetAttribLocation(buffer.program, "position");
+    buffer.scaleLocation = glGetUniformLocation(buffer.program, "scale");
+    buffer.offsetLocation = glGetUniformLocation(buffer.program, "offset");
+    buffer.pointSizeLocation = glGetUniformLocation(buffer.program, "pointSize");
+    return true;
+}
+
+bool initialise() {
+    if (buffer.ready || buffer.failed) {
+        return buffer.ready;
+    }
+    if (!GLAD_GL_VERSION_3_0 || !buildProgram()) {
+        std::cerr << "Particle rendering needs OpenGL 3.0" << std::endl;
+        buffer.failed = true;
+        return false;
+    }
+    glGenVertexArrays(1, &buffer.vao);
+    glGenBuffers(1, &buffer.vbo);
+    buffer.persistent = GLAD_GL_VERSION_4_4 != 0;
+    buffer.ready = true;
+    return true;
+}
+
+unsigned regionCount() {
+    return buffer.persistent ? REGIONS : 1;
+}
+
+void invalidateLive() {
+    for (unsigned r = 0; r < REGIONS; r++) {
+        buffer.liveValid[r] = false;
+        buffer.livePending[r].clear();
+    }
+}
+
+void waitForRegion(unsigned region) {
+    if (buffer.fences[region] != nullptr) {
+        glClientWaitSync(buffer.fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(buffer.fences[region]);
+        buffer.fences[region] = nullptr;
+    }
+}
+
+// Immutable storage cannot grow, so a larger persistent buffer replaces the old one
+void reserve(size_t bytes) {
+    if (bytes <= buffer.regionBytes) {
+        return;
+    }
+    size_t regionBytes = std::max(std::max(bytes, 2 * buffer.regionBytes), MIN_REGION_BYTES);
+    invalidateLive();
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+    if (buffer.persistent) {
+        for (unsigned r = 0; r < REGIONS; r++) {
+            waitForRegion(r);
+        }
+        if (buffer.mapped != nullptr) {
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            glDeleteBuffers(1, &buffer.vbo);
+            glGenBuffers(1, &buffer.vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+        }
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_ARRAY_BUFFER, REGIONS * regionBytes, nullptr, flags);
+        buffer.mapped = static_cast<char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, REGIONS * regionBytes, flags));
+        if (buffer.mapped == nullptr) {
+            std::cerr << "Persistent mapping failed, uploading with glBufferSubData" << std::endl;
+            glDeleteBuffers(1, &buffer.vbo);
+            glGenBuffers(1, &buffer.vbo);
+            glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+            buffer.persistent = false;
+        }
+    }
+    if (!buffer.persistent) {
+        glBufferData(GL_ARRAY_BUFFER, regionBytes, nullptr, GL_STREAM_DRAW);
+        buffer.staging.resize(regionBytes);
+    }
+    buffer.regionBytes = regionBytes;
+}
+
+// Moves to the next region and returns where its vertex data is to be written
+char* nextRegion() {
+    if (!buffer.persistent) {
+        return buffer.staging.data();
+    }
+    buffer.region = (buffer.region + 1) % REGIONS;
+    waitForRegion(buffer.region);
+    return buffer.mapped + buffer.region * buffer.regionBytes;
+}
+
+// Where this frame's vertex data is to be written. The live changes are not
+// followed while something else is drawn, so no region is up to date after.
+char* beginUpload(size_t bytes) {
+    reserve(bytes);
+    invalidateLive();
+    return nextRegion();
+}
+
+// Bytes [first, last) of the region, once written, reach the GPU
+void finishUpload(size_t first, size_t last) {
+    if (!buffer.persistent) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+        glBufferSubData(GL_ARRAY_BUFFER, first, last - first, buffer.staging.data() + first);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+}
+
+void draw(size_t count, GLenum type, float scale, float offset) {
+    glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+    size_t base = buffer.persistent ? buffer.region * buffer.regionBytes : 0;
+
+    glUseProgram(buffer.program);
+    glUniform1f(buffer.scaleLocation, scale);
+    glUniform1f(buffer.offsetLocation, offset);
+    glUniform1f(buffer.pointSizeLocation, POINT_SIZE);
+    glBindVertexArray(buffer.vao);
+    glEnableVertexAttribArray(buffer.positionLocation);
+    glVertexAttribPointer(buffer.positionLocation, 3, type, GL_FALSE, 0, reinterpret_cast<const void*>(base));
+    glEnable(GL_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE);  // Needed for gl_PointCoord in a compatibility context
+    glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(count));
+    glDisable(GL_POINT_SPRITE);
+    glDisable(GL_PROGRAM_POINT_SIZE);
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (buffer.persistent) {
+        if (buffer.fences[buffer.region] != nullptr) {
+            glDeleteSync(buffer.fences[buffer.region]);  // Drawn again without rewriting; this fence covers both
+        }
+        buffer.fences[buffer.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
+
+// Single-precision copies of the positions, which is all the GPU is given
+float* writePositions(float* out, const Particle* particles, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        out[0] = static_cast<float>(particles[i].x);
+        out[1] = static_cast<float>(particles[i].y);
+        out[2] = static_cast<float>(particles[i].z);
+        out += 3;
+    }
+    return out;
+}
+
+// Particles [first, last) of a snapshot, which may span several chunks
+void writeSnapshotRange(float* out, const BoxSnapshot& frame, size_t first, size_t last) {
+    const size_t chunkSize = BoxSnapshot::CHUNK_PARTICLES;
+    out += 3 * first;
+    while (first < last) {
+        const ParticleChunk& chunk = frame.getChunk(first / chunkSize);
+        size_t offset = first % chunkSize;
+        size_t n = std::min(last - first, chunk.size() - offset);
+        out = writePositions(out, chunk.data() + offset, n);
+        first += n;
+    }
+}
+
+void drawPositions(const Particle* particles, size_t count, double boxSize) {
+    if (count == 0 || !initialise()) {
+        return;
+    }
+    size_t bytes = count * 3 * sizeof(float);
+    writePositions(reinterpret_cast<float*>(beginUpload(bytes)), particles, count);
+    finishUpload(0, bytes);
+    draw(count, GL_FLOAT, static_cast<float>(2.0 / boxSize), -1.0f);
+}
+}
 
 void renderParticles(const Box& box) {
-    glPointSize(5.0f);  // Set particle size
-    glEnable(GL_POINT_SMOOTH);  // Enable smooth round points
-    glBegin(GL_POINTS);
+    drawPositions(box.getParticles(), box.getParticleCount(), box.getSize());
+}
 
-    double halfBoxSize = box.getSize() / 2.0;
+void renderParticles(const BoxSnapshot& frame) {
+    size_t count = frame.getParticleCount();
+    if (count == 0 || !initialise()) {
+        return;
+    }
+    size_t bytes = count * 3 * sizeof(float);
+    float* out = reinterpret_cast<float*>(beginUpload(bytes));
+    for (size_t c = 0; c < frame.getChunkCount(); ++c) {
+        const ParticleChunk& chunk = frame.getChunk(c);
+        out = writePositions(out, chunk.data(), chunk.size());
+    }
+    finishUpload(0, bytes);
+    draw(count, GL_FLOAT, static_cast<float>(2.0 / frame.getBoxSize()), -1.0f);
+}
 
-    // Set particle color to orange (RGB: 1.0, 0.5, 0.0)
-    for (size_t i = 0; i < box.getParticleCount(); ++i) {
-        const Particle& p = box.getParticle(i);
-        glColor3f(1.0f, 0.5f, 0.0f);  // Orange color
-        glVertex3f((p.x - halfBoxSize) / halfBoxSize,
-                   (p.y - halfBoxSize) / halfBoxSize,
-                   (p.z - halfBoxSize) / halfBoxSize);
+// With nothing changed the region drawn last is drawn again. Otherwise the
+// next region gets the changes it has missed, or everything when that is
+// most of the particles or the region holds something else.
+void renderParticles(const BoxSnapshot& frame, const DirtyRanges& changes) {
+    size_t count = frame.getParticleCount();
+    if (count == 0 || !initialise()) {
+        return;
+    }
+    size_t bytes = count * 3 * sizeof(float);
+    reserve(bytes);
+    if (count != buffer.liveCount) {
+        invalidateLive();
+        buffer.liveCount = count;
+    }
+    unsigned regions = regionCount();
+    for (unsigned r = 0; r < regions; r++) {
+        buffer.livePending[r].merge(changes);
+    }
+    const float scale = static_cast<float>(2.0 / frame.getBoxSize());
+    if (buffer.liveValid[buffer.region] && buffer.livePending[buffer.region].isEmpty()) {
+        draw(count, GL_FLOAT, scale, -1.0f);
+        return;
     }
 
-    glEnd();
+    float* out = reinterpret_cast<float*>(nextRegion());
+    DirtyRanges& pending = buffer.livePending[buffer.region];
+    pending.normalise();
+    const std::vector<DirtyRanges::Range>& ranges = pending.getRanges();
+    if (!buffer.liveValid[buffer.region] || pending.isAll() || ranges.size() > MAX_PARTIAL_RANGES ||
+        pending.getParticleCount() > count / FULL_UPLOAD_DIVISOR) {
+        writeSnapshotRange(out, frame, 0, count);
+        finishUpload(0, bytes);
+    } else {
+        const size_t stride = 3 * sizeof(float);
+        for (size_t r = 0; r < ranges.size() && ranges[r].first < count; r++) {
+            size_t last = std::min(ranges[r].second, count);
+            writeSnapshotRange(out, frame, ranges[r].first, last);
+            finishUpload(ranges[r].first * stride, last * stride);
+        }
+    }
+    pending.clear();
+    buffer.liveValid[buffer.region] = true;
+    draw(count, GL_FLOAT, scale, -1.0f);
+}
+
+// The 16-bit coordinates go to the GPU as they are; the shader maps level q
+// to the centre of its cell, (q + 0.5) * 2 / LEVELS - 1
+void renderParticles(const QuantisedFrame& frame) {
+    size_t count = frame.getParticleCount();
+    if (count == 0 || !initialise()) {
+        return;
+    }
+    size_t bytes = count * 3 * sizeof(uint16_t);
+    std::memcpy(beginUpload(bytes), frame.getCoordinates(), bytes);
+    finishUpload(0, bytes);
+    const float scale = 2.0f / QuantisedFrame::LEVELS;
+    draw(count, GL_UNSIGNED_SHORT, scale, 0.5f * scale - 1.0f);
+}
+
+void releaseRenderer() {
+    if (!buffer.ready) {
+        return;
+    }
+    for (unsigned r = 0; r < REGIONS; r++) {
+        waitForRegion(r);
+    }
+    if (buffer.mapped != nullptr) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer.vbo);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    glDeleteBuffers(1, &buffer.vbo);
+    glDeleteVertexArrays(1, &buffer.vao);
+    glDeleteProgram(buffer.program);
+    buffer = ParticleBuffer();
 }
@@ -1,20 +1,90 @@
 #include "Box.h"
+#include "BinaryIO.h"
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 
-Box::Box(double box_size) : size(box_size) {}
+Box::Box(double box_size) : size(box_size), particles(nullptr), count(0) {}
+
+Box::Box(const Box& other)
+    : size(other.size), particles(nullptr), count(other.count),
+      heapParticles(other.particles, other.particles + other.count), sharedChunks(other.sharedChunks),
+      dirtyChunks(other.dirtyChunks) {
+    particles = heapParticles.data();
+}
+
+Box& Box::operator=(const Box& other) {
+    assign(other);
+    return *this;
+}
+
+// The cached chunks stay valid, as they hold the same positions as other's
+bool Box::assign(const Box& other) {
+    if (this == &other) {
+        return true;
+    }
+    if (!resize(other.count)) {
+        return false;
+    }
+    std::copy(other.particles, other.particles + other.count, particles);
+    size = other.size;
+    if (state) {
+        state->setBoxSize(size);
+    }
+    sharedChunks = other.sharedChunks;
+    dirtyChunks = other.dirtyChunks;
+    changedRanges.markAll();
+    return true;
+}
+
+// Fails only when a state file cannot grow, leaving the particles as they were
+bool Box::resize(size_t particleCount) {
+    if (state) {
+        if (!state->reserve(particleCount)) {
+            return false;
+        }
+        state->resize(particleCount);
+        particles = state->getParticles();
+    } else {
+        heapParticles.resize(particleCount);
+        particles = heapParticles.data();
+    }
+    count = particleCount;
+    return true;
+}
 
 void Box::addParticle(const Particle& particle) {
-    particles.push_back(particle);
+    if (resize(count + 1)) {
+        particles[count - 1] = particle;
+        markDirty(count - 1);
+    }
 }
 
-double Box::calculateLennardJonesPotential(const Particle& p1, const Particle& p2) const {
+void Box::markDirty(size_t index) {
+    changedRanges.add(index);
+    size_t chunk = index / BoxSnapshot::CHUNK_PARTICLES;
+    if (chunk < dirtyChunks.size()) {
+        dirtyChunks[chunk] = 1;
+    }
+}
+
+void Box::markAllDirty() {
+    changedRanges.markAll();
+    std::fill(dirtyChunks.begin(), dirtyChunks.end(), 1);
+}
+
+double Box::minimumImageDistanceSquared(const Particle& p1, const Particle& p2) const {
     double dx = p1.x - p2.x;
     double dy = p1.y - p2.y;
     double dz = p1.z - p2.z;
     dx -= size * round(dx / size);
     dy -= size * round(dy / size);
     dz -= size * round(dz / size);
-    double r2 = dx * dx + dy * dy + dz * dz;
+    return dx * dx + dy * dy + dz * dz;
+}
+
+double Box::calculateLennardJonesPotential(const Particle& p1, const Particle& p2) const {
+    double r2 = minimumImageDistanceSquared(p1, p2);
     double r6 = r2 * r2 * r2;
     double r12 = r6 * r6;
     return 4 * 1.0 * (pow(1.0, 12) / r12 - pow(1.0, 6) / r6);
@@ -22,32 +92,215 @@ double Box::calculateLennardJonesPotential(const Particle& p1, const Particle& p
 
 double Box::calculateTotalEnergy() const {
     double totalEnergy = 0.0;
-    for (size_t i = 0; i < particles.size(); i++) {
-        for (size_t j = i + 1; j < particles.size(); j++) {
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
             totalEnergy += calculateLennardJonesPotential(particles[i], particles[j]);
         }
     }
     return totalEnergy;
 }
 
+double Box::calculateParticleEnergy(const Particle& particle, size_t skipIndex) const {
+    double energy = 0.0;
+    for (size_t j = 0; j < count; j++) {
+        if (j != skipIndex) {
+            energy += calculateLennardJonesPotential(particle, particles[j]);
+        }
+    }
+    return energy;
+}
+
+// Pair energy u = 4(r^-12 - r^-6) and pair virial w = r.F = 48 r^-12 - 24 r^-6
+void Box::calculateTotals(double& energy, double& virial) const {
+    energy = 0.0;
+    virial = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        for (size_t j = i + 1; j < count; j++) {
+            double r2 = minimumImageDistanceSquared(particles[i], particles[j]);
+            double inv6 = 1.0 / (r2 * r2 * r2);
+            energy += 4.0 * (inv6 * inv6 - inv6);
+            virial += 48.0 * inv6 * inv6 - 24.0 * inv6;
+        }
+    }
+}
+
+// Both deltas come out of the same O(N) pair loop, so the virial costs no extra pass
+void Box::calculateMoveDelta(size_t index, const Particle& trial, double& dE, double& dW) const {
+    const Particle& current = particles[index];
+    double newInv6 = 0.0, newInv12 = 0.0, oldInv6 = 0.0, oldInv12 = 0.0;
+    for (size_t j = 0; j < count; j++) {
+        if (j == index) {
+            continue;
+        }
+        double r2New = minimumImageDistanceSquared(trial, particles[j]);
+        double r2Old = minimumImageDistanceSquared(current, particles[j]);
+        double invNew = 1.0 / (r2New * r2New * r2New);
+        double invOld = 1.0 / (r2Old * r2Old * r2Old);
+        newInv6 += invNew;
+        newInv12 += invNew * invNew;
+        oldInv6 += invOld;
+        oldInv12 += invOld * invOld;
+    }
+    dE = 4.0 * ((newInv12 - oldInv12) - (newInv6 - oldInv6));
+    dW = 48.0 * (newInv12 - oldInv12) - 24.0 * (newInv6 - oldInv6);
+}
+
 void Box::applyPeriodicBoundaryConditions(Particle& particle) {
     particle.x -= size * floor(particle.x / size);
     particle.y -= size * floor(particle.y / size);
     particle.z -= size * floor(particle.z / size);
 }
 
-Particle& Box::getParticle(int index) const {
-    return const_cast<Particle&>(particles[index]);
+const Particle& Box::getParticle(size_t index) const {
+    return particles[index];
+}
+
+void Box::setParticle(size_t index, const Particle& particle) {
+    if (state) {
+        state->beginUpdate();
+    }
+    particles[index] = particle;
+    markDirty(index);
+}
+
+const Particle* Box::getParticles() const {
+    return particles;
 }
 
 size_t Box::getParticleCount() const {
-    return particles.size();
+    return count;
 }
 
 double Box::getSize() const {
     return size;
 }
 
+double Box::getVolume() const {
+    return size * size * size;
+}
+
+void Box::setSize(double newSize) {
+    if (state) {
+        state->setBoxSize(newSize);
+    }
+    double scale = newSize / size;
+    for (size_t i = 0; i < count; i++) {
+        particles[i].x *= scale;
+        particles[i].y *= scale;
+        particles[i].z *= scale;
+    }
+    size = newSize;
+    markAllDirty();
+}
+
+void Box::removeParticle(size_t index) {
+    particles[index] = particles[count - 1];
+    resize(count - 1);
+    markDirty(index);
+    markDirty(count);
+}
+
 void Box::clearParticles() {
-    particles.clear();
+    resize(0);
+    markAllDirty();
+}
+
+// Chunks past the end of the cache (new since the last snapshot) and chunks
+// whose length changed are rebuilt along with the dirty ones
+BoxSnapshot Box::snapshot(int step) {
+    const size_t chunkSize = BoxSnapshot::CHUNK_PARTICLES;
+    size_t chunkCount = (count + chunkSize - 1) / chunkSize;
+    sharedChunks.resize(chunkCount);
+    dirtyChunks.resize(chunkCount, 1);
+    for (size_t c = 0; c < chunkCount; c++) {
+        size_t begin = c * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        if (dirtyChunks[c] || !sharedChunks[c] || sharedChunks[c]->size() != end - begin) {
+            sharedChunks[c] = std::make_shared<const ParticleChunk>(particles + begin, particles + end);
+            dirtyChunks[c] = 0;
+        }
+    }
+
+    BoxSnapshot result;
+    result.step = step;
+    result.boxSize = size;
+    result.count = count;
+    result.chunks = sharedChunks;
+    return result;
+}
+
+DirtyRanges Box::takeChangedRanges() {
+    DirtyRanges taken;
+    std::swap(taken, changedRanges);
+    taken.normalise();
+    return taken;
+}
+
+// Same layout as writeBinaryVector
+void Box::save(std::ostream& out) const {
+    writeBinary(out, size);
+    writeBinary(out, static_cast<uint64_t>(count));
+    if (count > 0) {
+        out.write(reinterpret_cast<const char*>(particles), count * sizeof(Particle));
+    }
+}
+
+bool Box::load(std::istream& in) {
+    markAllDirty();
+    uint64_t loadedCount;
+    if (!readBinary(in, size) || !readBinary(in, loadedCount) || !resize(loadedCount)) {
+        return false;
+    }
+    if (state) {
+        state->setBoxSize(size);
+    }
+    if (count > 0) {
+        in.read(reinterpret_cast<char*>(particles), count * sizeof(Particle));
+    }
+    return static_cast<bool>(in);
+}
+
+bool Box::createStateFile(const std::string& filename) {
+    std::unique_ptr<StateFile> file(new StateFile());
+    if (!file->create(filename, count)) {
+        return false;
+    }
+    file->resize(count);
+    file->setBoxSize(size);
+    if (count > 0) {
+        std::memcpy(file->getParticles(), particles, count * sizeof(Particle));
+    }
+    state.reset(file.release());
+    particles = state->getParticles();
+    std::vector<Particle>().swap(heapParticles);
+    return true;
+}
+
+// Nothing is read here: the kernel pages the positions in as the pair loops reach them
+bool Box::openStateFile(const std::string& filename) {
+    closeStateFile();
+    std::unique_ptr<StateFile> file(new StateFile());
+    if (!file->open(filename)) {
+        return false;
+    }
+    state.reset(file.release());
+    std::vector<Particle>().swap(heapParticles);
+    particles = state->getParticles();
+    count = state->getParticleCount();
+    size = state->getBoxSize();
+    markAllDirty();
+    return true;
+}
+
+void Box::closeStateFile() {
+    if (!state) {
+        return;
+    }
+    heapParticles.assign(particles, particles + count);
+    particles = heapParticles.data();
+    state.reset();
+}
+
+StateFile* Box::getStateFile() {
+    return state.get();
 }
@@ -0,0 +1,52 @@
+#include "BoxSnapshot.h"
+#include <algorithm>
+#include <cstring>
+
+BoxSnapshot::BoxSnapshot() : step(0), boxSize(0.0), count(0) {}
+
+BoxSnapshot::BoxSnapshot(int step, double boxSize, const Particle* particles, size_t count)
+    : step(step), boxSize(boxSize), count(count) {
+    for (size_t begin = 0; begin < count; begin += CHUNK_PARTICLES) {
+        size_t end = std::min(count, begin + CHUNK_PARTICLES);
+        chunks.push_back(std::make_shared<const ParticleChunk>(particles + begin, particles + end));
+    }
+}
+
+void BoxSnapshot::clear() {
+    chunks.clear();
+    count = 0;
+}
+
+int BoxSnapshot::getStep() const {
+    return step;
+}
+
+double BoxSnapshot::getBoxSize() const {
+    return boxSize;
+}
+
+size_t BoxSnapshot::getParticleCount() const {
+    return count;
+}
+
+size_t BoxSnapshot::getChunkCount() const {
+    return chunks.size();
+}
+
+const ParticleChunk& BoxSnapshot::getChunk(size_t chunk) const {
+    return *chunks[chunk];
+}
+
+const Particle& BoxSnapshot::getParticle(size_t index) const {
+    return (*chunks[index / CHUNK_PARTICLES])[index % CHUNK_PARTICLES];
+}
+
+void BoxSnapshot::copyTo(Particle* out) const {
+    for (size_t c = 0; c < chunks.size(); c++) {
+        std::memcpy(out + c * CHUNK_PARTICLES, chunks[c]->data(), chunks[c]->size() * sizeof(Particle));
+    }
+}
+
+bool BoxSnapshot::sharesChunk(const BoxSnapshot& other, size_t chunk) const {
+    return chunk < chunks.size() && chunk < other.chunks.size() && chunks[chunk] == other.chunks[chunk];
+}
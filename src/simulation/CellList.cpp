@@ -0,0 +1,62 @@
+#include "CellList.h"
+#include <cmath>
+
+CellList::CellList() : cellsPerSide(1), cellSize(0.0) {}
+
+void CellList::build(const Box& box, double minCellSize) {
+    double size = box.getSize();
+    cellsPerSide = static_cast<int>(std::floor(size / minCellSize));
+
+    // With fewer than three cells per side the 27-cell stencil would visit
+    // the same cell twice, so fall back to a single cell
+    if (cellsPerSide < 3) {
+        cellsPerSide = 1;
+    }
+    cellSize = size / cellsPerSide;
+
+    head.assign(static_cast<size_t>(cellsPerSide) * cellsPerSide * cellsPerSide, -1);
+    next.assign(box.getParticleCount(), -1);
+
+    for (size_t i = 0; i < box.getParticleCount(); i++) {
+        const Particle& p = box.getParticle(i);
+        int ix = static_cast<int>(p.x / cellSize);
+        int iy = static_cast<int>(p.y / cellSize);
+        int iz = static_cast<int>(p.z / cellSize);
+        int cell = getCellIndex(ix, iy, iz);
+        next[i] = head[cell];
+        head[cell] = static_cast<int>(i);
+    }
+}
+
+int CellList::getCellsPerSide() const {
+    return cellsPerSide;
+}
+
+int CellList::getCellCount() const {
+    return static_cast<int>(head.size());
+}
+
+int CellList::getCellIndex(int ix, int iy, int iz) const {
+    ix = ((ix % cellsPerSide) + cellsPerSide) % cellsPerSide;
+    iy = ((iy % cellsPerSide) + cellsPerSide) % cellsPerSide;
+    iz = ((iz % cellsPerSide) + cellsPerSide) % cellsPerSide;
+    return (iz * cellsPerSide + iy) * cellsPerSide + ix;
+}
+
+void CellList::getCellCoordinates(int cell, int& ix, int& iy, int& iz) const {
+    ix = cell % cellsPerSide;
+    iy = (cell / cellsPerSide) % cellsPerSide;
+    iz = cell / (cellsPerSide * cellsPerSide);
+}
+
+int CellList::getNeighbourRange() const {
+    return cellsPerSide >= 3 ? 1 : 0;
+}
+
+int CellList::getHead(int cell) const {
+    return head[cell];
+}
+
+int CellList::getNext(int particle) const {
+    return next[particle];
+}
@@ -0,0 +1,87 @@
+#include "DirtyRanges.h"
+#include <algorithm>
+
+DirtyRanges::DirtyRanges() : all(false), normalised(true) {}
+
+void DirtyRanges::add(size_t index) {
+    addRange(index, index + 1);
+}
+
+// Extends the last range in place when the new one continues it, which keeps
+// sweeps in index order at one entry
+void DirtyRanges::addRange(size_t first, size_t last) {
+    if (all || first >= last) {
+        return;
+    }
+    if (!ranges.empty() && first >= ranges.back().first && first <= ranges.back().second) {
+        ranges.back().second = std::max(ranges.back().second, last);
+        return;
+    }
+    if (ranges.size() >= MAX_ENTRIES) {
+        markAll();
+        return;
+    }
+    normalised = normalised && (ranges.empty() || first > ranges.back().second);
+    ranges.push_back(Range(first, last));
+}
+
+void DirtyRanges::markAll() {
+    all = true;
+    ranges.clear();
+    normalised = true;
+}
+
+void DirtyRanges::merge(const DirtyRanges& other) {
+    if (other.all) {
+        markAll();
+        return;
+    }
+    for (size_t r = 0; r < other.ranges.size() && !all; r++) {
+        addRange(other.ranges[r].first, other.ranges[r].second);
+    }
+}
+
+void DirtyRanges::clear() {
+    ranges.clear();
+    all = false;
+    normalised = true;
+}
+
+void DirtyRanges::normalise() {
+    if (ranges.empty()) {
+        return;
+    }
+    if (!normalised) {
+        std::sort(ranges.begin(), ranges.end());
+    }
+    size_t kept = 0;
+    for (size_t r = 1; r < ranges.size(); r++) {
+        if (ranges[r].first <= ranges[kept].second + MERGE_GAP) {
+            ranges[kept].second = std::max(ranges[kept].second, ranges[r].second);
+        } else {
+            ranges[++kept] = ranges[r];
+        }
+    }
+    ranges.resize(kept + 1);
+    normalised = true;
+}
+
+bool DirtyRanges::isAll() const {
+    return all;
+}
+
+bool DirtyRanges::isEmpty() const {
+    return !all && ranges.empty();
+}
+
+const std::vector<DirtyRanges::Range>& DirtyRanges::getRanges() const {
+    return ranges;
+}
+
+size_t DirtyRanges::getParticleCount() const {
+    size_t count = 0;
+    for (size_t r = 0; r < ranges.size(); r++) {
+        count += ranges[r].second - ranges[r].first;
+    }
+    return count;
+}
@@ -0,0 +1,206 @@
+#include "GibbsEnsemble.h"
+#include <cmath>
+#include <thread>
+
+// Constructor
+GibbsEnsemble::GibbsEnsemble(int particlesA, int particlesB, double sizeA, double sizeB, double temperature)
+    : boxes{Box(sizeA), Box(sizeB)}, beta(1.0 / temperature), maxDisplacement(0.1), maxLogVolumeChange(0.01),
+      volumeMovesPerCycle(1), transfersPerCycle((particlesA + particlesB) / 10 + 1) {
+    for (int b = 0; b < 2; b++) {
+        int count = (b == 0) ? particlesA : particlesB;
+        for (int i = 0; i < count; i++) {
+            boxes[b].addParticle(Particle());
+        }
+        energies[b] = 0.0;
+    }
+    initialize(std::random_device()());
+}
+
+double GibbsEnsemble::uniform(std::mt19937& rng) {
+    return std::generate_canonical<double, 32>(rng);
+}
+
+// Place the particles of both boxes at random and reset the move statistics
+void GibbsEnsemble::initialize(unsigned int seed) {
+    boxRngs[0].seed(seed);
+    boxRngs[1].seed(seed + 1);
+    exchangeRng.seed(seed + 2);
+
+    for (int b = 0; b < 2; b++) {
+        size_t count = boxes[b].getParticleCount();
+        double size = boxes[b].getSize();
+        boxes[b].clearParticles();
+        for (size_t i = 0; i < count; i++) {
+            double x = uniform(exchangeRng) * size;
+            double y = uniform(exchangeRng) * size;
+            double z = uniform(exchangeRng) * size;
+            boxes[b].addParticle(Particle(x, y, z));
+        }
+        energies[b] = boxes[b].calculateTotalEnergy();
+        displacementAttempts[b] = displacementAccepts[b] = 0;
+    }
+    volumeAttempts = volumeAccepts = 0;
+    transferAttempts = transferAccepts = 0;
+}
+
+// N single-particle Metropolis moves in one box; touches only that box's state
+void GibbsEnsemble::displacementSweep(int which) {
+    Box& box = boxes[which];
+    std::mt19937& rng = boxRngs[which];
+    double energy = energies[which];
+    long long attempts = 0, accepts = 0;
+
+    size_t count = box.getParticleCount();
+    for (size_t move = 0; move < count; move++) {
+        size_t i = static_cast<size_t>(uniform(rng) * count) % count;
+        const Particle& particle = box.getParticle(i);
+        Particle trial = particle;
+        trial.move((uniform(rng) - 0.5) * maxDisplacement,
+                   (uniform(rng) - 0.5) * maxDisplacement,
+                   (uniform(rng) - 0.5) * maxDisplacement);
+        box.applyPeriodicBoundaryConditions(trial);
+
+        double dE = box.calculateParticleEnergy(trial, i) - box.calculateParticleEnergy(particle, i);
+        attempts++;
+        if (dE <= 0 || std::exp(-beta * dE) > uniform(rng)) {
+            box.setParticle(i, trial);
+            energy += dE;
+            accepts++;
+        }
+    }
+
+    energies[which] = energy;
+    displacementAttempts[which] += attempts;
+    displacementAccepts[which] += accepts;
+}
+
+// Exchange volume at fixed total volume with a random walk in ln(V1/V2)
+void GibbsEnsemble::volumeMove() {
+    double oldVolumes[2] = {boxes[0].getVolume(), boxes[1].getVolume()};
+    double totalVolume = oldVolumes[0] + oldVolumes[1];
+    double lnRatio = std::log(oldVolumes[0] / oldVolumes[1]) + (uniform(exchangeRng) - 0.5) * maxLogVolumeChange;
+    double newVolumes[2];
+    newVolumes[0] = totalVolume * std::exp(lnRatio) / (1.0 + std::exp(lnRatio));
+    newVolumes[1] = totalVolume - newVolumes[0];
+
+    // Rescale copies so a rejected move restores the exact previous coordinates
+    Box trial[2] = {boxes[0], boxes[1]};
+    double newEnergies[2];
+    trial[0].setSize(std::cbrt(newVolumes[0]));
+    trial[1].setSize(std::cbrt(newVolumes[1]));
+    std::thread worker([&]() { newEnergies[1] = trial[1].calculateTotalEnergy(); });
+    newEnergies[0] = trial[0].calculateTotalEnergy();
+    worker.join();
+
+    double arg = -beta * (newEnergies[0] - energies[0] + newEnergies[1] - energies[1]);
+    for (int b = 0; b < 2; b++) {
+        arg += (boxes[b].getParticleCount() + 1) * std::log(newVolumes[b] / oldVolumes[b]);
+    }
+
+    volumeAttempts++;
+    if (arg >= 0 || std::exp(arg) > uniform(exchangeRng)) {
+        for (int b = 0; b < 2; b++) {
+            boxes[b] = trial[b];
+            energies[b] = newEnergies[b];
+        }
+        volumeAccepts++;
+    }
+}
+
+// Move a random particle from one box to a random position in the other
+void GibbsEnsemble::transferMove() {
+    int from = uniform(exchangeRng) < 0.5 ? 0 : 1;
+    int to = 1 - from;
+    size_t fromCount = boxes[from].getParticleCount();
+    transferAttempts++;
+    if (fromCount == 0) {
+        return;
+    }
+
+    double toSize = boxes[to].getSize();
+    Particle inserted(uniform(exchangeRng) * toSize, uniform(exchangeRng) * toSize, uniform(exchangeRng) * toSize);
+    size_t removed = static_cast<size_t>(uniform(exchangeRng) * fromCount) % fromCount;
+
+    double insertEnergy = boxes[to].calculateParticleEnergy(inserted, boxes[to].getParticleCount());
+    double removeEnergy = boxes[from].calculateParticleEnergy(boxes[from].getParticle(removed), removed);
+
+    double arg = std::log(fromCount * boxes[to].getVolume() /
+                          ((boxes[to].getParticleCount() + 1) * boxes[from].getVolume()))
+                 - beta * (insertEnergy - removeEnergy);
+    if (arg >= 0 || std::exp(arg) > uniform(exchangeRng)) {
+        boxes[from].removeParticle(removed);
+        boxes[to].addParticle(inserted);
+        energies[from] -= removeEnergy;
+        energies[to] += insertEnergy;
+        transferAccepts++;
+    }
+}
+
+// The two sweeps run on separate threads; the exchange moves act as the synchronisation point
+void GibbsEnsemble::cycle() {
+    std::thread worker(&GibbsEnsemble::displacementSweep, this, 1);
+    displacementSweep(0);
+    worker.join();
+
+    for (int i = 0; i < volumeMovesPerCycle; i++) {
+        volumeMove();
+    }
+    for (int i = 0; i < transfersPerCycle; i++) {
+        transferMove();
+    }
+}
+
+void GibbsEnsemble::run(int cycles) {
+    for (int c = 0; c < cycles; c++) {
+        cycle();
+    }
+}
+
+// Setter and getter methods
+void GibbsEnsemble::setMaxDisplacement(double delta) {
+    maxDisplacement = delta;
+}
+
+void GibbsEnsemble::setMaxLogVolumeChange(double delta) {
+    maxLogVolumeChange = delta;
+}
+
+void GibbsEnsemble::setVolumeMovesPerCycle(int moves) {
+    volumeMovesPerCycle = moves;
+}
+
+void GibbsEnsemble::setTransfersPerCycle(int moves) {
+    transfersPerCycle = moves;
+}
+
+double GibbsEnsemble::getTemperature() const {
+    return 1.0 / beta;
+}
+
+void GibbsEnsemble::setTemperature(double temp) {
+    beta = 1.0 / temp;
+}
+
+Box& GibbsEnsemble::getBox(int which) {
+    return boxes[which];
+}
+
+double GibbsEnsemble::getEnergy(int which) const {
+    return energies[which];
+}
+
+double GibbsEnsemble::getDensity(int which) const {
+    return boxes[which].getParticleCount() / boxes[which].getVolume();
+}
+
+double GibbsEnsemble::getDisplacementAcceptance(int which) const {
+    return displacementAttempts[which] ? static_cast<double>(displacementAccepts[which]) / displacementAttempts[which] : 0.0;
+}
+
+double GibbsEnsemble::getVolumeAcceptance() const {
+    return volumeAttempts ? static_cast<double>(volumeAccepts) / volumeAttempts : 0.0;
+}
+
+double GibbsEnsemble::getTransferAcceptance() const {
+    return transferAttempts ? static_cast<double>(transferAccepts) / transferAttempts : 0.0;
+}
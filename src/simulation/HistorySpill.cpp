@@ -0,0 +1,217 @@
+#include "HistorySpill.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+const uint64_t MIN_MAPPING_BYTES = 64 << 20;
+}
+
+SpillReader::SpillReader(int descriptor) : fd(descriptor) {}
+
+SpillReader::~SpillReader() {
+    ::close(fd);
+}
+
+bool SpillReader::read(const SpilledFrame& frame, std::vector<Particle>& particles) const {
+    particles.resize(frame.count);
+    char* p = reinterpret_cast<char*>(particles.data());
+    size_t bytes = frame.count * sizeof(Particle);
+    uint64_t offset = frame.offset;
+    while (bytes > 0) {
+        ssize_t count = pread(fd, p, bytes, static_cast<off_t>(offset));
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        p += count;
+        offset += count;
+        bytes -= count;
+    }
+    return true;
+}
+
+HistorySpill::HistorySpill() : fd(-1), data(nullptr), mappedBytes(0), usedBytes(0) {}
+
+HistorySpill::~HistorySpill() {
+    close();
+}
+
+bool HistorySpill::open(const std::string& spillDirectory) {
+    close();
+    directory = spillDirectory;
+    std::string path = (directory.empty() ? std::string(".") : directory) + "/mchistory.XXXXXX";
+    std::vector<char> name(path.begin(), path.end());
+    name.push_back('\0');
+    fd = mkstemp(name.data());
+    if (fd < 0) {
+        std::cerr << "Error creating history file in " << directory << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    unlink(name.data());
+    return true;
+}
+
+void HistorySpill::close() {
+    if (data != nullptr) {
+        munmap(data, mappedBytes);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    mappedBytes = 0;
+    usedBytes = 0;
+    entries.clear();
+}
+
+bool HistorySpill::isOpen() const {
+    return fd >= 0;
+}
+
+// A new file rather than a truncated one, whose offsets a SpillReader may still be reading
+void HistorySpill::clear() {
+    entries.clear();
+    usedBytes = 0;
+    if (fd >= 0) {
+        open(directory);
+    }
+}
+
+// The mapping may extend past the end of the file; only the written part is
+// ever read. It grows in doubling steps, so it moves O(log n) times.
+bool HistorySpill::reserve(uint64_t bytes) {
+    if (bytes <= mappedBytes) {
+        return true;
+    }
+    uint64_t length = std::max(std::max(bytes, 2 * mappedBytes), MIN_MAPPING_BYTES);
+    void* mapping = data == nullptr ? mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0)
+                                    : mremap(data, mappedBytes, length, MREMAP_MAYMOVE);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping history file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    data = static_cast<char*>(mapping);
+    mappedBytes = length;
+    return true;
+}
+
+// Written through the file rather than the mapping, so a full disk is an
+// error here instead of a SIGBUS
+bool HistorySpill::write(const void* buffer, size_t bytes, uint64_t& offset) {
+    const char* p = static_cast<const char*>(buffer);
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, p, bytes, static_cast<off_t>(offset));
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            std::cerr << "Error spilling history frame: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        p += written;
+        offset += written;
+        bytes -= written;
+    }
+    return true;
+}
+
+// Frames start on 8-byte boundaries so full-precision ones can be read in place
+void HistorySpill::addEntry(const Entry& entry, uint64_t end) {
+    entries.push_back(entry);
+    usedBytes = (end + 7) & ~static_cast<uint64_t>(7);
+}
+
+bool HistorySpill::append(const BoxSnapshot& snapshot) {
+    if (fd < 0 || !reserve(usedBytes + snapshot.getParticleCount() * sizeof(Particle))) {
+        return false;
+    }
+    uint64_t offset = usedBytes;
+    for (size_t c = 0; c < snapshot.getChunkCount(); c++) {
+        const ParticleChunk& chunk = snapshot.getChunk(c);
+        if (!write(chunk.data(), chunk.size() * sizeof(Particle), offset)) {
+            return false;
+        }
+    }
+    Entry entry = {usedBytes, snapshot.getStep(), snapshot.getBoxSize(), snapshot.getParticleCount(), false};
+    addEntry(entry, offset);
+    return true;
+}
+
+bool HistorySpill::append(const QuantisedFrame& frame) {
+    if (fd < 0 || !reserve(usedBytes + frame.getBytes())) {
+        return false;
+    }
+    uint64_t offset = usedBytes;
+    if (!write(frame.getCoordinates(), frame.getBytes(), offset)) {
+        return false;
+    }
+    Entry entry = {usedBytes, frame.getStep(), frame.getBoxSize(), frame.getParticleCount(), true};
+    addEntry(entry, offset);
+    return true;
+}
+
+size_t HistorySpill::size() const {
+    return entries.size();
+}
+
+int HistorySpill::getStep(size_t frame) const {
+    return entries[frame].step;
+}
+
+// Asks for the whole frame at once rather than faulting it in page by page
+const char* HistorySpill::pageIn(const Entry& entry) const {
+    uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = entry.offset - entry.offset % page;
+    uint64_t bytes = entry.count * (entry.quantised ? 3 * sizeof(uint16_t) : sizeof(Particle));
+    madvise(data + start, entry.offset + bytes - start, MADV_WILLNEED);
+    return data + entry.offset;
+}
+
+BoxSnapshot HistorySpill::getFrame(size_t frame) const {
+    const Entry& entry = entries[frame];
+    if (entry.quantised) {
+        QuantisedFrame quantised;
+        getQuantisedFrame(frame, quantised);
+        return quantised.decode();
+    }
+    return BoxSnapshot(entry.step, entry.boxSize, reinterpret_cast<const Particle*>(pageIn(entry)), entry.count);
+}
+
+void HistorySpill::getQuantisedFrame(size_t frame, QuantisedFrame& quantised) const {
+    const Entry& entry = entries[frame];
+    if (entry.quantised) {
+        quantised.assign(entry.step, entry.boxSize, reinterpret_cast<const uint16_t*>(pageIn(entry)), entry.count);
+    } else {
+        quantised.encode(getFrame(frame));
+    }
+}
+
+uint64_t HistorySpill::getBytes() const {
+    return usedBytes;
+}
+
+bool HistorySpill::locate(size_t frame, SpilledFrame& location) const {
+    const Entry& entry = entries[frame];
+    location.offset = entry.offset;
+    location.step = entry.step;
+    location.boxSize = entry.boxSize;
+    location.count = entry.count;
+    return !entry.quantised;
+}
+
+std::shared_ptr<SpillReader> HistorySpill::share() const {
+    int descriptor = fd >= 0 ? dup(fd) : -1;
+    if (descriptor < 0) {
+        return std::shared_ptr<SpillReader>();
+    }
+    return std::make_shared<SpillReader>(descriptor);
+}
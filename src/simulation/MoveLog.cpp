@@ -0,0 +1,367 @@
+#include "MoveLog.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+namespace {
+const char LOG_MAGIC[8] = {'M', 'C', 'S', 'M', 'L', 'O', 'G', '\0'};
+const uint32_t LOG_VERSION = 2;
+
+bool eventBefore(const MoveEvent& event, int step) {
+    return event.step < step;
+}
+
+bool hasExtension(const std::string& filename, const std::string& extension) {
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+}
+
+MoveLog::MoveLog()
+    : particleCount(0), keyframeInterval(1), boxSize(0.0), lastStep(-1), memoryLimit(DEFAULT_MEMORY_LIMIT) {}
+
+void MoveLog::start(const BoxSnapshot& initial, int interval) {
+    clear();
+    particleCount = initial.getParticleCount();
+    boxSize = initial.getBoxSize();
+    keyframeInterval = std::max(1, interval);
+    keyframeSteps.push_back(initial.getStep());
+    keyframes.push_back(initial);
+    lastStep = initial.getStep();
+}
+
+void MoveLog::clear() {
+    keyframeSteps.clear();
+    keyframes.clear();
+    events.clear();
+    particleCount = 0;
+    lastStep = -1;
+}
+
+bool MoveLog::isStarted() const {
+    return !keyframeSteps.empty();
+}
+
+void MoveLog::setMemoryLimit(size_t bytes) {
+    memoryLimit = bytes;
+}
+
+// Moves up to a keyframe's step are contained in that keyframe, so dropping
+// the keyframes before it also drops those moves
+size_t MoveLog::bytesAfterDropping(size_t count) const {
+    size_t firstEvent = std::lower_bound(events.begin(), events.end(), keyframeSteps[count] + 1, eventBefore) -
+                        events.begin();
+    return (keyframeSteps.size() - count) * (sizeof(int) + particleCount * sizeof(Particle)) +
+           (events.size() - firstEvent) * sizeof(MoveEvent);
+}
+
+void MoveLog::drop(size_t count) {
+    std::vector<MoveEvent>::iterator firstEvent =
+        std::lower_bound(events.begin(), events.end(), keyframeSteps[count] + 1, eventBefore);
+    events.erase(events.begin(), firstEvent);
+    keyframes.erase(keyframes.begin(), keyframes.begin() + count);
+    keyframeSteps.erase(keyframeSteps.begin(), keyframeSteps.begin() + count);
+}
+
+// Drops down to three quarters of the limit, so the vectors are shifted once
+// every few keyframe intervals rather than at every keyframe. The newest
+// keyframe always stays, so a log can exceed the limit by one interval's moves.
+void MoveLog::dropOldest() {
+    size_t target = memoryLimit / 4 * 3;
+    size_t count = 1;
+    while (count + 1 < keyframeSteps.size() && bytesAfterDropping(count) > target) {
+        count++;
+    }
+    if (count < keyframeSteps.size()) {
+        drop(count);
+    }
+}
+
+void MoveLog::discardBefore(int step) {
+    size_t count = std::upper_bound(keyframeSteps.begin(), keyframeSteps.end(), step) - keyframeSteps.begin();
+    if (count > 1) {
+        drop(count - 1);
+    }
+}
+
+void MoveLog::recordMove(int step, size_t index, const Particle& position) {
+    MoveEvent event = {step, static_cast<uint32_t>(index), position.x, position.y, position.z};
+    events.push_back(event);
+}
+
+bool MoveLog::endStep(int step) {
+    lastStep = step;
+    if (memoryLimit > 0 && keyframeSteps.size() > 1 && getMemoryBytes() > memoryLimit) {
+        dropOldest();
+    }
+    return step % keyframeInterval == 0 && step != keyframeSteps.back();
+}
+
+void MoveLog::addKeyframe(const BoxSnapshot& keyframe) {
+    keyframeSteps.push_back(keyframe.getStep());
+    keyframes.push_back(keyframe);
+}
+
+bool MoveLog::reconstruct(int step, std::vector<Particle>& particles) const {
+    if (keyframeSteps.empty() || step < keyframeSteps.front() || step > lastStep) {
+        return false;
+    }
+    size_t keyframe = std::upper_bound(keyframeSteps.begin(), keyframeSteps.end(), step) - keyframeSteps.begin() - 1;
+    particles.resize(particleCount);
+    keyframes[keyframe].copyTo(particles.data());
+
+    // Events of steps (keyframe step, step]
+    std::vector<MoveEvent>::const_iterator first =
+        std::lower_bound(events.begin(), events.end(), keyframeSteps[keyframe] + 1, eventBefore);
+    for (std::vector<MoveEvent>::const_iterator event = first; event != events.end() && event->step <= step; ++event) {
+        particles[event->index] = Particle(event->x, event->y, event->z);
+    }
+    return true;
+}
+
+// Keyframes are shared snapshots, so only the moves are copied
+void MoveLog::getSegments(int afterStep, std::vector<MoveLogSegment>& segments) const {
+    std::vector<MoveEvent>::const_iterator event =
+        std::lower_bound(events.begin(), events.end(), afterStep + 1, eventBefore);
+    int covered = afterStep;
+    for (size_t k = 0; k < keyframeSteps.size(); k++) {
+        if (keyframeSteps[k] <= afterStep) {
+            continue;
+        }
+        std::vector<MoveEvent>::const_iterator end =
+            std::lower_bound(event, events.end(), keyframeSteps[k] + 1, eventBefore);
+        segments.push_back(MoveLogSegment());
+        segments.back().events.assign(event, end);
+        segments.back().lastStep = keyframeSteps[k];
+        segments.back().keyframe = keyframes[k];
+        event = end;
+        covered = keyframeSteps[k];
+    }
+    if (lastStep > covered) {
+        segments.push_back(MoveLogSegment());
+        segments.back().events.assign(event, events.end());
+        segments.back().lastStep = lastStep;
+    }
+}
+
+// Blocks are read one at a time, and each one's count is checked against
+// what is left of the file before anything is allocated for it. Keyframes
+// and moves before the one firstStep needs are dropped as reading goes on.
+bool MoveLog::load(const std::string& filename, int firstStep, int lastStepWanted) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t remaining = static_cast<uint64_t>(file.tellg());
+    file.seekg(0, std::ios::beg);
+    MoveLogHeader header;
+    if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC)) != 0 || header.version != LOG_VERSION) {
+        std::cerr << filename << " is not a version " << LOG_VERSION << " move log" << std::endl;
+        return false;
+    }
+    remaining -= sizeof(header);
+    if (header.particleCount == 0 || header.particleCount > remaining / sizeof(Particle)) {
+        std::cerr << "Move log " << filename << " has a corrupt header" << std::endl;
+        return false;
+    }
+    clear();
+    particleCount = header.particleCount;
+    boxSize = header.boxSize;
+
+    bool corrupt = false;
+    std::vector<Particle> keyframe;
+    std::vector<MoveEvent> blockEvents;
+    MoveLogBlock block;
+    while (lastStep < lastStepWanted && remaining >= sizeof(block) &&
+           file.read(reinterpret_cast<char*>(&block), sizeof(block))) {
+        remaining -= sizeof(block);
+        bool isKeyframe = block.type == MOVE_LOG_KEYFRAME;
+        uint64_t itemBytes = isKeyframe ? sizeof(Particle) : sizeof(MoveEvent);
+        if (block.count > remaining / itemBytes) {
+            break;  // Cut short while it was being written
+        }
+        remaining -= block.count * itemBytes;
+        if ((!isKeyframe && block.type != MOVE_LOG_MOVES) || (keyframeSteps.empty() && !isKeyframe) ||
+            (isKeyframe && block.count != particleCount) || block.step < lastStep) {
+            corrupt = true;
+            break;
+        }
+
+        if (isKeyframe) {
+            keyframe.resize(particleCount);
+            file.read(reinterpret_cast<char*>(keyframe.data()), keyframe.size() * sizeof(Particle));
+            addKeyframe(BoxSnapshot(block.step, boxSize, keyframe.data(), keyframe.size()));
+            if (block.step <= firstStep) {
+                discardBefore(firstStep);
+            }
+        } else {
+            blockEvents.resize(block.count);
+            file.read(reinterpret_cast<char*>(blockEvents.data()), blockEvents.size() * sizeof(MoveEvent));
+            for (size_t e = 0; e < blockEvents.size() && !corrupt; e++) {
+                const MoveEvent& event = blockEvents[e];
+                corrupt = event.index >= particleCount || event.step <= lastStep || event.step > block.step ||
+                          (e > 0 && event.step < blockEvents[e - 1].step);
+            }
+            if (corrupt) {
+                break;
+            }
+            events.insert(events.end(), blockEvents.begin(), blockEvents.end());
+        }
+        lastStep = block.step;
+        if (!file) {
+            break;
+        }
+    }
+    if (corrupt || !file || keyframeSteps.empty()) {
+        std::cerr << "Move log " << filename << " is corrupt" << std::endl;
+        clear();
+        return false;
+    }
+    return true;
+}
+
+int MoveLog::getFirstStep() const {
+    return keyframeSteps.empty() ? -1 : keyframeSteps.front();
+}
+
+int MoveLog::getLastStep() const {
+    return lastStep;
+}
+
+size_t MoveLog::getParticleCount() const {
+    return particleCount;
+}
+
+double MoveLog::getBoxSize() const {
+    return boxSize;
+}
+
+size_t MoveLog::getKeyframeCount() const {
+    return keyframeSteps.size();
+}
+
+int MoveLog::getKeyframeStep(size_t keyframe) const {
+    return keyframeSteps[keyframe];
+}
+
+size_t MoveLog::getEventCount() const {
+    return events.size();
+}
+
+// Keyframes share chunks with the history, so this is an upper bound
+size_t MoveLog::getMemoryBytes() const {
+    return keyframeSteps.size() * (sizeof(int) + particleCount * sizeof(Particle)) + events.size() * sizeof(MoveEvent);
+}
+
+MoveLogSink::MoveLogSink(uint64_t seed) : headerWritten(false), lastStep(-1) {
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+    header.version = LOG_VERSION;
+    header.seed = seed;
+}
+
+bool MoveLogSink::open(const std::string& filename, double boxSize) {
+    if (!file.open(filename)) {
+        return false;
+    }
+    header.boxSize = boxSize;
+    headerWritten = false;
+    lastStep = -1;
+    return true;
+}
+
+// The moves refer to box indices, so a keyframe must hold every particle in order
+bool MoveLogSink::write(const Frame& frame) {
+    if (frame.ids != nullptr) {
+        std::cerr << "Skipping keyframe " << frame.step << ": a move log needs every particle" << std::endl;
+        return false;
+    }
+    if (!headerWritten) {
+        header.particleCount = frame.count;
+        file.write(&header, sizeof(header));
+        headerWritten = true;
+    }
+    if (frame.count != header.particleCount || frame.step < lastStep) {
+        std::cerr << "Skipping keyframe " << frame.step << ": " << frame.count << " particles after step " << lastStep
+                  << ", log has " << header.particleCount << std::endl;
+        return false;
+    }
+    MoveLogBlock block = {MOVE_LOG_KEYFRAME, frame.step, frame.count};
+    lastStep = frame.step;
+    return file.write(&block, sizeof(block)) && file.write(frame.particles, frame.count * sizeof(Particle));
+}
+
+bool MoveLogSink::writeMoves(const MoveEvent* moves, size_t count, int step) {
+    if (!headerWritten || step < lastStep) {
+        return false;
+    }
+    MoveLogBlock block = {MOVE_LOG_MOVES, step, count};
+    lastStep = step;
+    return file.write(&block, sizeof(block)) && file.write(moves, count * sizeof(MoveEvent));
+}
+
+bool MoveLogSink::acceptsMoves() const {
+    return true;
+}
+
+bool MoveLogSink::hasFixedParticleCount() const {
+    return true;
+}
+
+void MoveLogSink::flush() {
+    file.flush();
+}
+
+void MoveLogSink::close() {
+    file.close();
+}
+
+bool convertMoveLog(const std::string& input, const std::string& output, int firstStep, int lastStep, int every) {
+    if (hasExtension(output, ".mclog")) {
+        std::cerr << "A move log can only be recorded by a run" << std::endl;
+        return false;
+    }
+    MoveLog log;
+    if (!log.load(input, firstStep, lastStep)) {
+        return false;
+    }
+    int first = std::max(firstStep, log.getFirstStep());
+    int last = std::min(lastStep, log.getLastStep());
+    if (first > last) {
+        std::cerr << "No steps from " << firstStep << " to " << lastStep << " in " << input << std::endl;
+        return false;
+    }
+    std::unique_ptr<TrajectorySink> sink(createTrajectorySink(output, TrajectoryOptions()));
+    if (!sink->open(output, log.getBoxSize())) {
+        return false;
+    }
+
+    std::vector<int> steps;
+    if (every > 0) {
+        for (long long step = first; step <= last; step += every) {
+            steps.push_back(static_cast<int>(step));
+        }
+    } else {
+        for (size_t k = 0; k < log.getKeyframeCount(); k++) {
+            if (log.getKeyframeStep(k) >= first && log.getKeyframeStep(k) <= last) {
+                steps.push_back(log.getKeyframeStep(k));
+            }
+        }
+    }
+    std::vector<Particle> particles;
+    for (size_t s = 0; s < steps.size(); s++) {
+        log.reconstruct(steps[s], particles);
+        Frame frame;
+        frame.step = steps[s];
+        frame.particles = particles.data();
+        frame.count = particles.size();
+        sink->write(frame);
+    }
+    sink->close();
+    return true;
+}
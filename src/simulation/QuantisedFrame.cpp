@@ -0,0 +1,71 @@
+#include "QuantisedFrame.h"
+#include <algorithm>
+
+namespace {
+uint16_t quantise(double coordinate, double scale) {
+    double level = coordinate * scale;
+    return static_cast<uint16_t>(std::min(std::max(level, 0.0), QuantisedFrame::LEVELS - 1.0));
+}
+}
+
+QuantisedFrame::QuantisedFrame() : step(0), boxSize(0.0) {}
+
+void QuantisedFrame::encode(const BoxSnapshot& snapshot) {
+    step = snapshot.getStep();
+    boxSize = snapshot.getBoxSize();
+    coordinates.resize(3 * snapshot.getParticleCount());
+    double scale = boxSize > 0.0 ? LEVELS / boxSize : 0.0;
+    uint16_t* out = coordinates.data();
+    for (size_t c = 0; c < snapshot.getChunkCount(); c++) {
+        const ParticleChunk& chunk = snapshot.getChunk(c);
+        for (size_t i = 0; i < chunk.size(); i++) {
+            *out++ = quantise(chunk[i].x, scale);
+            *out++ = quantise(chunk[i].y, scale);
+            *out++ = quantise(chunk[i].z, scale);
+        }
+    }
+}
+
+void QuantisedFrame::assign(int frameStep, double frameBoxSize, const uint16_t* data, size_t count) {
+    step = frameStep;
+    boxSize = frameBoxSize;
+    coordinates.assign(data, data + 3 * count);
+}
+
+BoxSnapshot QuantisedFrame::decode() const {
+    std::vector<Particle> particles(getParticleCount());
+    for (size_t i = 0; i < particles.size(); i++) {
+        particles[i] = getParticle(i);
+    }
+    return BoxSnapshot(step, boxSize, particles.data(), particles.size());
+}
+
+void QuantisedFrame::clear() {
+    coordinates.clear();
+}
+
+int QuantisedFrame::getStep() const {
+    return step;
+}
+
+double QuantisedFrame::getBoxSize() const {
+    return boxSize;
+}
+
+size_t QuantisedFrame::getParticleCount() const {
+    return coordinates.size() / 3;
+}
+
+const uint16_t* QuantisedFrame::getCoordinates() const {
+    return coordinates.data();
+}
+
+Particle QuantisedFrame::getParticle(size_t index) const {
+    double unit = boxSize / LEVELS;
+    const uint16_t* q = &coordinates[3 * index];
+    return Particle((q[0] + 0.5) * unit, (q[1] + 0.5) * unit, (q[2] + 0.5) * unit);
+}
+
+size_t QuantisedFrame::getBytes() const {
+    return coordinates.size() * sizeof(uint16_t);
+}
@@ -1,107 +1,784 @@
 #include "Simulation.h"
-#include <fstream>
+#include "AsyncFile.h"
+#include "BinaryIO.h"
+#include "ConfigurationLoader.h"
 #include <iostream>
+#include <fstream>
+#include <sstream>
+#include <csignal>
+#include <cerrno>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include <cmath>
+#include <algorithm>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+const char CHECKPOINT_MAGIC[8] = {'M', 'C', 'S', 'C', 'H', 'K', 'P', 'T'};
+const uint32_t CHECKPOINT_VERSION = 1;
+
+volatile std::sig_atomic_t checkpointRequested = 0;
+
+void requestCheckpoint(int) {
+    checkpointRequested = 1;
+}
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+}
 
 // Constructor
 Simulation::Simulation(int particles, int steps, double temperature, double box_size)
-    : box(box_size), numParticles(particles), numSteps(steps), intervalSteps(1), beta(1.0 / temperature) {}
+    : box(box_size), numParticles(particles), numSteps(steps), intervalSteps(1), beta(1.0 / temperature),
+      requestedSeed(0), seed(0), currentStep(0), stepSize(0.1), energy(0.0), virial(0.0), magnitudeScale(0.0),
+      structureFactorEnabled(false), stoppingQuantity(Observables::ENERGY), targetError(0.0), targetReached(false),
+      historyFrames(1000), historyBytes(0), historyQuantised(false), saveMode(FIXED_INTERVAL),
+      saveQuantity(Observables::ENERGY), saveThreshold(0.0), nextSaveStep(0), lastSavedValue(0.0),
+      lastPersistedStep(-1), moveLogEnabled(false),
+      moveLogKeyframeInterval(1000), checkpointInterval(0),
+      checkpointForking(false), maxCheckpointChildren(1), stateSyncInterval(0) {
+    std::memset(&checkpointStats, 0, sizeof(checkpointStats));
+}
+
+Simulation::~Simulation() {
+    reapCheckpointChildren(true);
+}
+
+// 32 random bits scaled into [0, 1)
+double Simulation::uniform() {
+    return rng() * (1.0 / 4294967296.0);
+}
 
 // Initialize particles
 void Simulation::initialize() {
     box.clearParticles();
-    std::srand(std::time(nullptr));
+    seed = requestedSeed != 0 ? requestedSeed : static_cast<unsigned int>(std::time(nullptr));
+    rng.seed(seed);
     for (int i = 0; i < numParticles; i++) {
-        double x = static_cast<double>(std::rand()) / RAND_MAX * box.getSize();
-        double y = static_cast<double>(std::rand()) / RAND_MAX * box.getSize();
-        double z = static_cast<double>(std::rand()) / RAND_MAX * box.getSize();
+        double x = uniform() * box.getSize();
+        double y = uniform() * box.getSize();
+        double z = uniform() * box.getSize();
         box.addParticle(Particle(x, y, z));
     }
-    savedSteps.clear();
+    if (box.getParticleCount() != static_cast<size_t>(numParticles)) {
+        std::cerr << "State file full, running with " << box.getParticleCount() << " particles" << std::endl;
+        numParticles = static_cast<int>(box.getParticleCount());
+    }
+    startRun();
+}
+
+// Start a new run from a saved frame. Positions are wrapped into the box,
+// which keeps its current size if the file does not record one.
+bool Simulation::initializeFromFile(const std::string& filename, long long frame) {
+    Configuration configuration;
+    if (!loadConfiguration(filename, frame, configuration) || configuration.particles.empty()) {
+        return false;
+    }
+    Box loadedBox(configuration.boxSize > 0.0 ? configuration.boxSize : box.getSize());
+    for (size_t i = 0; i < configuration.particles.size(); i++) {
+        loadedBox.applyPeriodicBoundaryConditions(configuration.particles[i]);
+        loadedBox.addParticle(configuration.particles[i]);
+    }
+    if (!box.assign(loadedBox)) {
+        std::cerr << "No room for " << filename << " in the state file" << std::endl;
+        return false;
+    }
+    numParticles = static_cast<int>(box.getParticleCount());
+    seed = requestedSeed != 0 ? requestedSeed : static_cast<unsigned int>(std::time(nullptr));
+    rng.seed(seed);
+    startRun();
+    return true;
+}
+
+// Reset the counters and accumulators for a run starting from the current box
+void Simulation::startRun() {
+    currentStep = 0;
+    recomputeTotals();
+    observables.reset(numParticles, box.getVolume(), getTemperature());
+    targetReached = false;
+    radialDistribution.reset();
+    if (structureFactorEnabled) {
+        structureFactor.initialize(box);
+    }
+
+    // Preallocate the history for this particle count and save the initial state
+    if (historyBytes > 0) {
+        savedSteps.configureBytes(box.getParticleCount(), historyBytes, historyQuantised);
+    } else {
+        savedSteps.configure(box.getParticleCount(), historyFrames, historyQuantised);
+    }
+    savedSteps.push(box.snapshot(0));
+    scheduleNextSave();
+    if (moveLogEnabled) {
+        endMoveLogStream();
+        moveLog.start(savedSteps.back(), moveLogKeyframeInterval);
+    }
 
-    // Save initial state
-    std::vector<Particle> initialParticles;
-    for (size_t i = 0; i < box.getParticleCount(); ++i) {
-        initialParticles.push_back(box.getParticle(i));
+    // An open trajectory keeps streaming; the new run's steps start again from 0
+    lastPersistedStep = -1;
+    if (trajectoryWriter.isOpen() && trajectoryWriter.submit(savedSteps.back())) {
+        lastPersistedStep = 0;
     }
-    savedSteps.push_back({0, initialParticles});
+    commitState();
 }
 
 // Perform a single step of the simulation
 void Simulation::step() {
-    int i = std::rand() % numParticles;
-    Particle& particle = box.getParticle(i);
-    double oldX = particle.x, oldY = particle.y, oldZ = particle.z;
+    int i = static_cast<int>(rng() % numParticles);
+    const Particle& particle = box.getParticle(i);
 
     // Random displacement with scaling for smoother motion
-    double dx = (static_cast<double>(std::rand()) / RAND_MAX - 0.5) * 0.1;
-    double dy = (static_cast<double>(std::rand()) / RAND_MAX - 0.5) * 0.1;
-    double dz = (static_cast<double>(std::rand()) / RAND_MAX - 0.5) * 0.1;
+    double dx = (uniform() - 0.5) * stepSize;
+    double dy = (uniform() - 0.5) * stepSize;
+    double dz = (uniform() - 0.5) * stepSize;
 
-    particle.move(dx, dy, dz);
-    box.applyPeriodicBoundaryConditions(particle);
+    Particle trial = particle;
+    trial.move(dx, dy, dz);
+    box.applyPeriodicBoundaryConditions(trial);
 
-    // Energy calculation
-    double oldEnergy = box.calculateTotalEnergy();
-    particle.x = oldX, particle.y = oldY, particle.z = oldZ;
-    double newEnergy = box.calculateTotalEnergy();
-    double dE = newEnergy - oldEnergy;
+    // Energy and virial change of the move, from a single pass over the other particles
+    double dE, dW;
+    box.calculateMoveDelta(i, trial, dE, dW);
 
     // Metropolis criterion
-    if (dE > 0 && exp(-beta * dE) < static_cast<double>(std::rand()) / RAND_MAX) {
-        particle.x = oldX, particle.y = oldY, particle.z = oldZ; // Reject move
-    } else {
-        particle.move(dx, dy, dz); // Accept move
+    if (dE <= 0 || exp(-beta * dE) > uniform()) {
+        if (structureFactorEnabled) {
+            structureFactor.particleMoved(particle, trial);
+        }
+        if (moveLogEnabled) {
+            moveLog.recordMove(currentStep + 1, i, trial);
+        }
+        box.setParticle(i, trial); // Accept move
+        energy += dE;
+        virial += dW;
+
+        // Overlaps in the initial configuration give totals many orders of magnitude above
+        // their equilibrium value; once they relax, the accumulated rounding error would
+        // dominate, so recompute from scratch whenever the totals have shrunk that far.
+        double magnitude = std::max(std::fabs(energy), std::fabs(virial));
+        if (magnitude > magnitudeScale) {
+            magnitudeScale = magnitude;
+        } else if (magnitudeScale > 1e3 * (1.0 + magnitude)) {
+            recomputeTotals();
+        }
     }
+
+    currentStep++;
+    observables.sample(energy, virial);
+    commitState();
 }
 
 // Run simulation for a specific number of steps
 void Simulation::run(int stepsToRun) {
-    for (int step = 1; step <= stepsToRun; step++) {
+    for (int n = 0; n < stepsToRun; n++) {
         this->step();
 
-        // Save state at intervals
-        if (step % intervalSteps == 0 || step == numSteps) {
-            std::vector<Particle> currentStepParticles;
-            for (size_t i = 0; i < box.getParticleCount(); ++i) {
-                currentStepParticles.push_back(box.getParticle(i));
+        // Save state at intervals. While moves are recorded they replace the
+        // frames: the history and a frame trajectory get the keyframes only,
+        // and a move log file is streamed the moves up to each keyframe.
+        if (moveLogEnabled) {
+            if (moveLog.endStep(currentStep) || currentStep == numSteps) {
+                savedSteps.push(box.snapshot(currentStep));
+                scheduleNextSave();
+                moveLog.addKeyframe(savedSteps.back());
+                if (trajectoryWriter.acceptsMoves()) {
+                    streamMoveLog();
+                } else if (trajectoryWriter.isOpen() && trajectoryWriter.submit(savedSteps.back())) {
+                    lastPersistedStep = currentStep;
+                }
+            }
+        } else if (isSaveDue()) {
+            savedSteps.push(box.snapshot(currentStep));
+            scheduleNextSave();
+            if (trajectoryWriter.isOpen() && trajectoryWriter.submit(savedSteps.back())) {
+                lastPersistedStep = currentStep;
             }
-            savedSteps.push_back({step, currentStepParticles});
+        }
+
+        // Sample g(r) every few sweeps of N moves
+        if (currentStep % (radialDistribution.getSampleInterval() * numParticles) == 0) {
+            radialDistribution.sample(box);
+        }
+        if (structureFactorEnabled && currentStep % (structureFactor.getSampleInterval() * numParticles) == 0) {
+            structureFactor.sample();
+        }
+
+        // Stop once the requested observable is known precisely enough, checked once per sweep
+        bool converged = targetError > 0.0 && currentStep % numParticles == 0 &&
+                         observables.isConverged(stoppingQuantity, targetError);
+        if (converged) {
+            targetReached = true;
+        }
+
+        // Checkpoint after all of this step's bookkeeping, so a restart resumes at the next step
+        // A signalled request stays pending until a forked checkpoint can actually start.
+        if (!checkpointChildren.empty()) {
+            reapCheckpointChildren(false);
+        }
+        if (!checkpointFile.empty()) {
+            if (checkpointRequested) {
+                if (checkpoint()) {
+                    checkpointRequested = 0;
+                }
+            } else if (checkpointInterval > 0 && currentStep % checkpointInterval == 0) {
+                checkpoint();
+            }
+        }
+        if (stateSyncInterval > 0 && currentStep % stateSyncInterval == 0 && box.getStateFile()) {
+            box.getStateFile()->sync();
+        }
+        if (converged) {
+            break;
         }
     }
 }
 
-// Save particle states to file
-void Simulation::saveParticles(const std::string& filename) const {
-    std::ofstream file(filename, std::ios::app);
-    if (!file.is_open()) {
-        std::cerr << "Error opening file " << filename << std::endl;
+// Instantaneous value of an observable, per particle except for the pressure
+double Simulation::getInstantaneous(Observables::Quantity quantity) const {
+    switch (quantity) {
+    case Observables::VIRIAL:
+        return virial / numParticles;
+    case Observables::PRESSURE:
+        return numParticles / (beta * box.getVolume()) + virial / (3.0 * box.getVolume());
+    default:
+        return energy / numParticles;
+    }
+}
+
+bool Simulation::isSaveDue() const {
+    if (currentStep == numSteps) {
+        return true;
+    }
+    switch (saveMode) {
+    case DECORRELATION:
+        return currentStep >= nextSaveStep;
+    case OBSERVABLE_CHANGE:
+        return std::fabs(getInstantaneous(saveQuantity) - lastSavedValue) >= saveThreshold;
+    default:
+        return currentStep % intervalSteps == 0;
+    }
+}
+
+void Simulation::scheduleNextSave() {
+    nextSaveStep = currentStep + getSaveInterval();
+    lastSavedValue = getInstantaneous(saveQuantity);
+}
+
+void Simulation::recomputeTotals() {
+    box.calculateTotals(energy, virial);
+    magnitudeScale = std::max(std::fabs(energy), std::fabs(virial));
+}
+
+// Save particle states to file. Frames already handed to the writer are not
+// written again; after this call every newly saved frame is streamed as well.
+// A file that is not the one being streamed to is started afresh. The backlog
+// is handed to the writer thread as references to the history frames, so
+// this returns at once and the writer pages in, formats and writes them. Of
+// a quantised history only the newest frame is exact, so the older ones are
+// left out rather than written as if they were.
+// A .mclog file receives the move log recorded so far instead, then the
+// moves and keyframes as they are recorded; a stopped log is written whole.
+void Simulation::saveParticles(const std::string& filename) {
+    bool moves = filename.size() > 6 && filename.compare(filename.size() - 6, 6, ".mclog") == 0;
+    if (moves && !moveLog.isStarted()) {
+        std::cerr << "Enable Record Moves before saving a move log" << std::endl;
+        return;
+    }
+    if (!trajectoryWriter.isOpen() || trajectoryWriter.getFilename() != filename) {
+        endMoveLogStream();
+        trajectoryOptions.seed = seed;
+        if (!trajectoryWriter.open(filename, box.getSize(), createTrajectorySink(filename, trajectoryOptions),
+                                   trajectoryOptions.filter)) {
+            return;
+        }
+        lastPersistedStep = -1;
+    }
+    if (trajectoryWriter.acceptsMoves()) {
+        streamMoveLog();
+        if (!moveLogEnabled) {
+            trajectoryWriter.close();
+        }
         return;
     }
 
-    for (const auto& stepData : savedSteps) {
-        int stepNumber = stepData.first;
-        const std::vector<Particle>& particles = stepData.second;
+    if (savedSteps.isQuantised()) {
+        size_t skipped = 0;
+        for (size_t f = 0; f + 1 < savedSteps.size(); ++f) {
+            skipped += savedSteps.getStep(f) > lastPersistedStep;
+        }
+        if (skipped > 0) {
+            std::cerr << "Not writing " << skipped << " quantised history frames, only the newest is exact" << std::endl;
+        }
+    }
+    std::shared_ptr<HistoryBacklog> backlog = std::make_shared<HistoryBacklog>();
+    savedSteps.getFramesAfter(lastPersistedStep, *backlog);
+    if (backlog->size() > 0 && trajectoryWriter.submit(backlog)) {
+        lastPersistedStep = backlog->getStep(backlog->size() - 1);
+    }
+}
+
+// Hands the keyframes and moves not yet written to the writer thread; only
+// the newest keyframe and the moves after it stay in memory
+void Simulation::streamMoveLog() {
+    std::shared_ptr<std::vector<MoveLogSegment>> segments = std::make_shared<std::vector<MoveLogSegment>>();
+    moveLog.getSegments(lastPersistedStep, *segments);
+    if (!segments->empty() && trajectoryWriter.submit(segments)) {
+        lastPersistedStep = segments->back().lastStep;
+        moveLog.discardBefore(lastPersistedStep);
+    }
+}
+
+// A move log file holds one recording, so it is finished before the log restarts or stops
+void Simulation::endMoveLogStream() {
+    if (trajectoryWriter.acceptsMoves()) {
+        streamMoveLog();
+        std::cerr << "Move log " << trajectoryWriter.getFilename() << " ends at step " << moveLog.getLastStep()
+                  << "; save again to record from here" << std::endl;
+        trajectoryWriter.close();
+    }
+}
+
+void Simulation::writeCheckpoint(std::ostream& out, const Box& configuration) const {
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+    writeBinary(out, CHECKPOINT_VERSION);
+    writeBinary(out, numParticles);
+    writeBinary(out, numSteps);
+    writeBinary(out, intervalSteps);
+    writeBinary(out, beta);
+    writeBinary(out, requestedSeed);
+    writeBinary(out, seed);
+    writeBinary(out, currentStep);
+    writeBinary(out, energy);
+    writeBinary(out, virial);
+    writeBinary(out, magnitudeScale);
+    writeBinary(out, stepSize);
+
+    // The standard text form of the engine is its complete state
+    std::ostringstream engine;
+    engine << rng;
+    std::string engineState = engine.str();
+    writeBinaryVector(out, std::vector<char>(engineState.begin(), engineState.end()));
+
+    writeBinary(out, static_cast<int32_t>(stoppingQuantity));
+    writeBinary(out, targetError);
+    writeBinary(out, static_cast<uint8_t>(targetReached));
+    writeBinary(out, static_cast<uint8_t>(structureFactorEnabled));
+
+    configuration.save(out);
+    observables.save(out);
+    radialDistribution.save(out);
+    if (structureFactorEnabled) {
+        structureFactor.save(out);
+    }
+}
+
+bool Simulation::saveCheckpoint(const std::string& filename) const {
+    return saveCheckpoint(filename, box);
+}
+
+bool Simulation::saveCheckpoint(const std::string& filename, const Box& configuration) const {
+    // Named per process so concurrent forked checkpoints never share a temporary file
+    std::string temporary = filename + "." + std::to_string(::getpid()) + ".tmp";
+    AsyncFile file;
+    if (!file.open(temporary)) {
+        return false;
+    }
+    AsyncFileStreamBuffer buffer(file);
+    std::ostream out(&buffer);
+    writeCheckpoint(out, configuration);
+
+    // Make the contents durable before the rename replaces the previous checkpoint
+    bool written = out && file.sync();
+    if (!file.close() || !written) {
+        std::cerr << "Error writing checkpoint " << temporary << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::cerr << "Error renaming " << temporary << " to " << filename << std::endl;
+        std::remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Everything is read into temporaries first and only swapped in once the whole file has parsed
+bool Simulation::loadCheckpoint(const std::string& filename) {
+    std::ifstream in(filename, std::ios::binary);
+    if (!in.is_open()) {
+        std::cerr << "Error opening file " << filename << std::endl;
+        return false;
+    }
+    char magic[8];
+    uint32_t version;
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 || !readBinary(in, version) ||
+        version != CHECKPOINT_VERSION) {
+        std::cerr << filename << " is not a version " << CHECKPOINT_VERSION << " checkpoint" << std::endl;
+        return false;
+    }
+
+    int particles, steps, interval, step;
+    double loadedBeta, loadedEnergy, loadedVirial, loadedScale, loadedStepSize, loadedTarget;
+    unsigned int loadedRequestedSeed, loadedSeed;
+    std::vector<char> engineState;
+    int32_t quantity;
+    uint8_t reached, structureFactorFlag;
+    bool ok = readBinary(in, particles) && readBinary(in, steps) && readBinary(in, interval) &&
+              readBinary(in, loadedBeta) && readBinary(in, loadedRequestedSeed) && readBinary(in, loadedSeed) &&
+              readBinary(in, step) && readBinary(in, loadedEnergy) && readBinary(in, loadedVirial) &&
+              readBinary(in, loadedScale) && readBinary(in, loadedStepSize) && readBinaryVector(in, engineState) &&
+              readBinary(in, quantity) && readBinary(in, loadedTarget) && readBinary(in, reached) &&
+              readBinary(in, structureFactorFlag);
 
-        file << "ITEM: TIMESTEP\n" << stepNumber << "\n";
-        file << "ITEM: NUMBER OF ATOMS\n" << particles.size() << "\n";
-        file << "ITEM: BOX BOUNDS pp pp pp\n";
-        file << "0 " << box.getSize() << "\n0 " << box.getSize() << "\n0 " << box.getSize() << "\n";
-        file << "ITEM: ATOMS id x y z\n";
+    std::mt19937 engine;
+    if (ok) {
+        std::istringstream engineText(std::string(engineState.begin(), engineState.end()));
+        engineText >> engine;
+        ok = !engineText.fail();
+    }
+    Box loadedBox(0.0);
+    Observables loadedObservables;
+    RadialDistribution loadedRadialDistribution;
+    StructureFactor loadedStructureFactor;
+    ok = ok && loadedBox.load(in) && loadedBox.getParticleCount() == static_cast<size_t>(particles) &&
+         loadedObservables.load(in) && loadedRadialDistribution.load(in) &&
+         (!structureFactorFlag || loadedStructureFactor.load(in, loadedBox));
+    if (!ok) {
+        std::cerr << "Checkpoint " << filename << " is truncated or corrupt" << std::endl;
+        return false;
+    }
 
-        for (size_t i = 0; i < particles.size(); ++i) {
-            const Particle& p = particles[i];
-            file << (i + 1) << " " << p.x << " " << p.y << " " << p.z << "\n";
+    if (!box.assign(loadedBox)) {
+        std::cerr << "No room for checkpoint " << filename << " in the state file" << std::endl;
+        return false;
+    }
+    numParticles = particles;
+    numSteps = steps;
+    intervalSteps = interval;
+    beta = loadedBeta;
+    requestedSeed = loadedRequestedSeed;
+    seed = loadedSeed;
+    currentStep = step;
+    rng = engine;
+    stepSize = loadedStepSize;
+    energy = loadedEnergy;
+    virial = loadedVirial;
+    magnitudeScale = loadedScale;
+    observables = loadedObservables;
+    radialDistribution = loadedRadialDistribution;
+    if (structureFactorFlag) {
+        structureFactor = loadedStructureFactor;
+    }
+    structureFactorEnabled = structureFactorFlag != 0;
+    stoppingQuantity = static_cast<Observables::Quantity>(quantity);
+    targetError = loadedTarget;
+    targetReached = reached != 0;
+
+    // History restarts from the restored frame, which the original run has already streamed if it was saving
+    if (historyBytes > 0) {
+        savedSteps.configureBytes(box.getParticleCount(), historyBytes, historyQuantised);
+    } else {
+        savedSteps.configure(box.getParticleCount(), historyFrames, historyQuantised);
+    }
+    savedSteps.push(box.snapshot(currentStep));
+    scheduleNextSave();
+    if (moveLogEnabled) {
+        endMoveLogStream();
+        moveLog.start(savedSteps.back(), moveLogKeyframeInterval);
+    }
+    lastPersistedStep = currentStep;
+    commitState();
+    return true;
+}
+
+void Simulation::setCheckpoint(const std::string& filename, int interval) {
+    checkpointFile = filename;
+    checkpointInterval = interval;
+}
+
+// The child holds a copy-on-write image of this process frozen at the fork, so
+// it can serialise at leisure while the parent carries on; only the page table
+// copy in fork() pauses the run. The child touches nothing but the checkpoint
+// file and leaves with _exit so no destructor joins threads it does not have.
+// Particles in a state file are a shared mapping, which the child would see
+// the parent go on changing, so they are copied to the heap before the fork.
+bool Simulation::checkpoint() {
+    if (checkpointFile.empty()) {
+        return false;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!checkpointForking) {
+        bool ok = saveCheckpoint(checkpointFile);
+        double elapsed = millisecondsSince(start);
+        recordCheckpoint(ok, elapsed, elapsed);
+        return ok;
+    }
+
+    reapCheckpointChildren(false);
+    if (static_cast<int>(checkpointChildren.size()) >= maxCheckpointChildren) {
+        checkpointStats.skipped++;
+        return false;
+    }
+    std::unique_ptr<Box> frozen;
+    if (box.getStateFile()) {
+        frozen.reset(new Box(box));
+    }
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::_exit(saveCheckpoint(checkpointFile, frozen ? *frozen : box) ? 0 : 1);
+    }
+    if (pid < 0) {
+        std::cerr << "fork failed, writing checkpoint in process" << std::endl;
+        bool ok = saveCheckpoint(checkpointFile);
+        double elapsed = millisecondsSince(start);
+        recordCheckpoint(ok, elapsed, elapsed);
+        return ok;
+    }
+    double pause = millisecondsSince(start);
+    checkpointStats.lastPauseMs = pause;
+    checkpointStats.maxPauseMs = std::max(checkpointStats.maxPauseMs, pause);
+    checkpointChildren.push_back(std::make_pair(pid, start));
+    checkpointStats.activeChildren = static_cast<int>(checkpointChildren.size());
+    return true;
+}
+
+void Simulation::recordCheckpoint(bool ok, double pauseMs, double latencyMs) {
+    if (ok) {
+        checkpointStats.completed++;
+    } else {
+        checkpointStats.failed++;
+    }
+    checkpointStats.lastPauseMs = pauseMs;
+    checkpointStats.maxPauseMs = std::max(checkpointStats.maxPauseMs, pauseMs);
+    checkpointStats.lastLatencyMs = latencyMs;
+    checkpointStats.maxLatencyMs = std::max(checkpointStats.maxLatencyMs, latencyMs);
+}
+
+// Collect finished children without blocking, or all of them when wait is set
+void Simulation::reapCheckpointChildren(bool wait) {
+    for (size_t c = 0; c < checkpointChildren.size();) {
+        int status = 0;
+        pid_t result;
+        do {
+            result = ::waitpid(checkpointChildren[c].first, &status, wait ? 0 : WNOHANG);
+        } while (result < 0 && errno == EINTR);
+        if (result == 0) {
+            c++;
+            continue;
         }
+        bool ok = result > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        if (ok) {
+            checkpointStats.completed++;
+        } else {
+            checkpointStats.failed++;
+        }
+        double latency = millisecondsSince(checkpointChildren[c].second);
+        checkpointStats.lastLatencyMs = latency;
+        checkpointStats.maxLatencyMs = std::max(checkpointStats.maxLatencyMs, latency);
+        checkpointChildren.erase(checkpointChildren.begin() + c);
+    }
+    checkpointStats.activeChildren = static_cast<int>(checkpointChildren.size());
+}
+
+// More than one child lets a slow checkpoint overlap the next, but the last to
+// finish wins the rename, so a single child keeps the file strictly newest
+void Simulation::setCheckpointForking(bool enabled, int maxChildren) {
+    checkpointForking = enabled;
+    maxCheckpointChildren = std::max(1, maxChildren);
+}
+
+bool Simulation::isCheckpointForking() const {
+    return checkpointForking;
+}
+
+const CheckpointStats& Simulation::getCheckpointStats() const {
+    return checkpointStats;
+}
+
+void Simulation::installCheckpointSignalHandler() {
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = requestCheckpoint;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+void Simulation::commitState() {
+    if (StateFile* file = box.getStateFile()) {
+        file->commit(currentStep, energy, virial, beta, stepSize);
+    }
+}
+
+bool Simulation::setStateFile(const std::string& filename, int syncInterval) {
+    stateSyncInterval = std::max(0, syncInterval);
+    if (filename.empty()) {
+        box.closeStateFile();
+        return true;
+    }
+    if (!box.createStateFile(filename)) {
+        return false;
     }
-    file.close();
+    commitState();
+    return box.getStateFile()->sync();
+}
+
+// The totals are only recomputed, at O(N^2), when the file may have been left
+// between an update and its commit or by a machine that crashed since
+bool Simulation::restoreStateFile(const std::string& filename, int syncInterval) {
+    StateFile probe;
+    if (!probe.attach(filename)) {
+        return false;
+    }
+    if (probe.getParticleCount() == 0 || probe.getBoxSize() <= 0.0 || probe.getBeta() <= 0.0) {
+        std::cerr << "State file " << filename << " holds no configuration" << std::endl;
+        return false;
+    }
+    probe.close();
+    if (!box.openStateFile(filename)) {
+        return false;
+    }
+    const StateFile& file = *box.getStateFile();
+    stateSyncInterval = std::max(0, syncInterval);
+
+    numParticles = static_cast<int>(box.getParticleCount());
+    currentStep = file.getStep();
+    beta = file.getBeta();
+    stepSize = file.getStepSize();
+    if (file.isConsistent()) {
+        energy = file.getEnergy();
+        virial = file.getVirial();
+        magnitudeScale = std::max(std::fabs(energy), std::fabs(virial));
+    } else {
+        std::cerr << "State file " << filename << " was not closed cleanly, recomputing the totals" << std::endl;
+        recomputeTotals();
+    }
+    seed = requestedSeed != 0 ? requestedSeed : static_cast<unsigned int>(std::time(nullptr));
+    rng.seed(seed);
+    observables.reset(numParticles, box.getVolume(), getTemperature());
+    targetReached = false;
+    radialDistribution.reset();
+    if (structureFactorEnabled) {
+        structureFactor.initialize(box);
+    }
+
+    if (historyBytes > 0) {
+        savedSteps.configureBytes(box.getParticleCount(), historyBytes, historyQuantised);
+    } else {
+        savedSteps.configure(box.getParticleCount(), historyFrames, historyQuantised);
+    }
+    // The history starts with the first frame saved from here on; a frame of
+    // the restored state would read every particle in before the first step
+    scheduleNextSave();
+    if (moveLogEnabled) {
+        endMoveLogStream();
+        moveLog.start(box.snapshot(currentStep), moveLogKeyframeInterval);
+    }
+    lastPersistedStep = currentStep;
+    commitState();
+    return true;
+}
+
+bool Simulation::hasStateFile() {
+    return box.getStateFile() != nullptr;
+}
+
+void Simulation::stopSaving() {
+    endMoveLogStream();
+    trajectoryWriter.close();
+}
+
+const TrajectoryWriter& Simulation::getTrajectoryWriter() const {
+    return trajectoryWriter;
+}
+
+TrajectoryOptions& Simulation::getTrajectoryOptions() {
+    return trajectoryOptions;
+}
+
+// Get the latest saved frame (for rendering)
+const BoxSnapshot& Simulation::getLatestFrame() const {
+    return savedSteps.back();
+}
+
+BoxSnapshot Simulation::getSnapshot() {
+    return box.snapshot(currentStep);
+}
+
+const SnapshotRing& Simulation::getSavedSteps() const {
+    return savedSteps;
 }
 
-// Get current particles (for rendering)
-const std::vector<Particle>& Simulation::getCurrentParticles() const {
-    return savedSteps.back().second;
+void Simulation::setHistoryFrames(size_t frames) {
+    historyFrames = frames;
+    historyBytes = 0;
+}
+
+void Simulation::setHistoryBytes(size_t bytes) {
+    historyBytes = bytes;
+}
+
+void Simulation::setHistoryQuantised(bool quantised) {
+    historyQuantised = quantised;
+}
+
+bool Simulation::isHistoryQuantised() const {
+    return historyQuantised;
+}
+
+bool Simulation::setHistorySpill(const std::string& directory) {
+    return savedSteps.setSpillDirectory(directory);
+}
+
+void Simulation::setSaveMode(SaveMode mode, Observables::Quantity quantity, double threshold) {
+    saveMode = mode;
+    saveQuantity = quantity;
+    saveThreshold = threshold;
+    scheduleNextSave();
+}
+
+Simulation::SaveMode Simulation::getSaveMode() const {
+    return saveMode;
+}
+
+// Frames one statistical inefficiency g = 1 + 2 tau apart are effectively
+// independent. Until the series has equilibrated tau is not meaningful, so the
+// fixed interval is used.
+int Simulation::getSaveInterval() const {
+    const TimeSeries& series = observables.getSeries(saveQuantity);
+    if (!series.isEquilibrated() || series.getAutocorrelationTime() <= 0.0) {
+        return std::max(1, intervalSteps);
+    }
+    double inefficiency = 1.0 + 2.0 * series.getAutocorrelationTime();
+    return static_cast<int>(std::min(std::ceil(inefficiency), 1e9));
+}
+
+void Simulation::setMoveLogEnabled(bool enabled, int keyframeInterval) {
+    endMoveLogStream();
+    moveLogEnabled = enabled;
+    moveLogKeyframeInterval = keyframeInterval;
+    // A log stopped here can still be saved; it is replaced when recording starts again
+    if (enabled) {
+        moveLog.start(box.snapshot(currentStep), keyframeInterval);
+    }
+    scheduleNextSave();
+}
+
+void Simulation::setMoveLogMemoryLimit(size_t bytes) {
+    moveLog.setMemoryLimit(bytes);
+}
+
+bool Simulation::isMoveLogEnabled() const {
+    return moveLogEnabled;
+}
+
+const MoveLog& Simulation::getMoveLog() const {
+    return moveLog;
 }
 
 // Setter and getter methods
@@ -129,10 +806,72 @@ void Simulation::setTemperature(double temp) {
     beta = 1.0 / temp;
 }
 
+unsigned int Simulation::getSeed() const {
+    return seed;
+}
+
+void Simulation::setSeed(unsigned int value) {
+    requestedSeed = value;
+}
+
+double Simulation::getStepSize() const {
+    return stepSize;
+}
+
+void Simulation::setStepSize(double size) {
+    stepSize = size;
+}
+
 void Simulation::setIntervalSteps(int interval) {
     intervalSteps = interval;
 }
 
+int Simulation::getCurrentStep() const {
+    return currentStep;
+}
+
+double Simulation::getEnergy() const {
+    return energy;
+}
+
+double Simulation::getVirial() const {
+    return virial;
+}
+
+const Observables& Simulation::getObservables() const {
+    return observables;
+}
+
+void Simulation::setStoppingRule(Observables::Quantity quantity, double standardError) {
+    stoppingQuantity = quantity;
+    targetError = standardError;
+    targetReached = false;
+}
+
+bool Simulation::hasReachedTarget() const {
+    return targetReached;
+}
+
+const RadialDistribution& Simulation::getRadialDistribution() const {
+    return radialDistribution;
+}
+
+const StructureFactor& Simulation::getStructureFactor() const {
+    return structureFactor;
+}
+
+// Enabling rebuilds rho(k) from the current configuration; from then on it follows the moves
+void Simulation::setStructureFactorEnabled(bool enabled) {
+    if (enabled && !structureFactorEnabled) {
+        structureFactor.initialize(box);
+    }
+    structureFactorEnabled = enabled;
+}
+
+bool Simulation::isStructureFactorEnabled() const {
+    return structureFactorEnabled;
+}
+
 Box& Simulation::getBox() {
     return box;
 }
@@ -0,0 +1,221 @@
+#include "SimulationEngine.h"
+#include <algorithm>
+#include <chrono>
+
+namespace {
+// Batches this long keep a queued command waiting no more than about a millisecond
+const double MIN_BATCH_SECONDS = 0.5e-3;
+const double MAX_BATCH_SECONDS = 2e-3;
+const int MAX_STEPS_PER_BATCH = 1 << 20;
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+}
+
+// The first frame is published before the thread starts, so the UI always has one
+SimulationEngine::SimulationEngine(Simulation& target)
+    : simulation(target), commands(COMMAND_CAPACITY), posted(0), stopping(false), executed(0), running(false),
+      stepsPerBatch(1), stepsPerSecond(0.0), historyIndex(-1), historyStep(-1) {
+    publish();
+    frames.update();
+    worker = std::thread(&SimulationEngine::loop, this);
+}
+
+SimulationEngine::~SimulationEngine() {
+    stopping.store(true, std::memory_order_release);
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void SimulationEngine::loop() {
+    std::chrono::steady_clock::time_point lastPublish = std::chrono::steady_clock::now();
+    while (!stopping.load(std::memory_order_acquire)) {
+        bool changed = executeCommands();
+        if (running) {
+            runBatch();
+            if (simulation.hasReachedTarget() || simulation.getCurrentStep() >= simulation.getNumSteps()) {
+                running = false;
+                changed = true;
+            }
+        } else if (!changed) {
+            std::unique_lock<std::mutex> lock(idleMutex);
+            wake.wait(lock, [this]() { return stopping.load(std::memory_order_acquire) || !commands.empty(); });
+            continue;
+        }
+        if (changed || secondsSince(lastPublish) >= 1.0 / PUBLISH_HZ) {
+            publish();
+            lastPublish = std::chrono::steady_clock::now();
+        }
+    }
+}
+
+bool SimulationEngine::executeCommands() {
+    Command command;
+    bool any = false;
+    while (commands.pop(command)) {
+        command(simulation);
+        executed++;
+        any = true;
+    }
+    return any;
+}
+
+// The batch doubles or halves until it takes between MIN_ and MAX_BATCH_SECONDS,
+// and never goes past the run's last step, where run() saves the final frame
+void SimulationEngine::runBatch() {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int firstStep = simulation.getCurrentStep();
+    int remaining = simulation.getNumSteps() - firstStep;
+    if (remaining <= 0) {
+        return;
+    }
+    simulation.run(std::min(stepsPerBatch, remaining));
+    double seconds = secondsSince(start);
+    int steps = simulation.getCurrentStep() - firstStep;
+    if (seconds > 0.0 && steps > 0) {
+        stepsPerSecond = 0.9 * stepsPerSecond + 0.1 * (steps / seconds);
+    }
+    if (seconds < MIN_BATCH_SECONDS) {
+        stepsPerBatch = std::min(2 * stepsPerBatch, MAX_STEPS_PER_BATCH);
+    } else if (seconds > MAX_BATCH_SECONDS && stepsPerBatch > 1) {
+        stepsPerBatch /= 2;
+    }
+}
+
+// The history shifts as frames are added, so the selected index is looked up
+// again, but a frame is only read (possibly from disk) when its step changes
+void SimulationEngine::fetchHistoryFrame() {
+    const SnapshotRing& history = simulation.getSavedSteps();
+    if (historyIndex < 0 || history.size() == 0) {
+        historyFrame = BoxSnapshot();
+        historyQuantised.reset();
+        historyStep = -1;
+        return;
+    }
+    size_t index = std::min(static_cast<size_t>(historyIndex), history.size() - 1);
+    int step = history.getStep(index);
+    if (step == historyStep && (historyQuantised || historyFrame.getParticleCount() > 0)) {
+        return;
+    }
+    historyStep = step;
+    if (history.isQuantised()) {
+        std::shared_ptr<QuantisedFrame> quantised = std::make_shared<QuantisedFrame>();
+        history.getQuantisedFrame(index, *quantised);
+        historyQuantised = quantised;
+        historyFrame = BoxSnapshot();
+    } else {
+        historyFrame = history.getFrame(index);
+        historyQuantised.reset();
+    }
+}
+
+void SimulationEngine::publish() {
+    EngineFrame& frame = frames.getBack();
+    frame.commandsDone = executed;
+    frame.running = running;
+    frame.stepsPerSecond = running ? stepsPerSecond : 0.0;
+
+    frame.live = simulation.getSnapshot();
+    DirtyRanges changes = simulation.getBox().takeChangedRanges();
+    frame.liveChanges = unseenChanges;
+    frame.liveChanges.merge(changes);
+    frame.liveChanges.normalise();
+    fetchHistoryFrame();
+    const SnapshotRing& history = simulation.getSavedSteps();
+    frame.historyIndex = historyIndex;
+    frame.historyStep = historyStep;
+    frame.history = historyFrame;
+    frame.historyQuantised = historyQuantised;
+    frame.historySize = history.size();
+    frame.historySpilling = history.isSpilling();
+    frame.spilledFrames = history.getSpilledFrames();
+    frame.spilledBytes = history.getSpilledBytes();
+
+    const Observables& observables = simulation.getObservables();
+    const TimeSeries& energySeries = observables.getEnergyStat();
+    frame.step = simulation.getCurrentStep();
+    frame.numParticles = simulation.getNumParticles();
+    frame.numSteps = simulation.getNumSteps();
+    frame.temperature = simulation.getTemperature();
+    frame.boxSize = simulation.getBox().getSize();
+    frame.energyPerParticle = observables.getEnergyPerParticle();
+    frame.pressure = observables.getPressure();
+    frame.pressureError = observables.getPressureStat().getStandardError();
+    frame.heatCapacity = observables.getHeatCapacity();
+    frame.compressibility = observables.getCompressibilityFactor();
+    frame.equilibrated = energySeries.isEquilibrated();
+    frame.burnIn = energySeries.getBurnIn();
+    frame.autocorrelationTime = energySeries.getAutocorrelationTime();
+    frame.targetReached = simulation.hasReachedTarget();
+    frame.saveInterval = simulation.getSaveInterval();
+
+    const RadialDistribution& rdf = simulation.getRadialDistribution();
+    frame.gofr = rdf.getValues();
+    frame.rdfMaxRadius = rdf.getMaxRadius();
+    frame.rdfSamples = rdf.getSampleCount();
+    frame.structureFactorEnabled = simulation.isStructureFactorEnabled();
+    if (frame.structureFactorEnabled) {
+        simulation.getStructureFactor().getValues(frame.kValues, frame.sofk);
+    } else {
+        frame.kValues.clear();
+        frame.sofk.clear();
+    }
+
+    const TrajectoryWriter& writer = simulation.getTrajectoryWriter();
+    frame.writerOpen = writer.isOpen();
+    frame.writerFilename = writer.isOpen() ? writer.getFilename() : std::string();
+    frame.writtenFrames = writer.getWrittenFrames();
+    frame.droppedFrames = writer.getDroppedFrames();
+    const MoveLog& moveLog = simulation.getMoveLog();
+    frame.moveLogEnabled = simulation.isMoveLogEnabled();
+    frame.moveLogFirstStep = moveLog.getFirstStep();
+    frame.moveLogLastStep = moveLog.getLastStep();
+    frame.moveLogEvents = moveLog.getEventCount();
+    frame.moveLogKeyframes = moveLog.getKeyframeCount();
+    frame.moveLogBytes = moveLog.getMemoryBytes();
+    frame.checkpointForking = simulation.isCheckpointForking();
+    frame.checkpoints = simulation.getCheckpointStats();
+    frame.stateFile = simulation.hasStateFile();
+
+    // A frame the UI skipped never reached the renderer, so its changes ride along
+    // with the next one until a frame is known to have been taken
+    DirtyRanges published = frame.liveChanges;
+    if (frames.publish()) {
+        unseenChanges = changes;
+    } else {
+        unseenChanges = published;
+    }
+}
+
+// A full queue means the engine is behind by COMMAND_CAPACITY commands, which
+// only a stalled engine thread can cause; the UI waits rather than drop one
+uint64_t SimulationEngine::post(const Command& command) {
+    while (!commands.push(command)) {
+        std::this_thread::yield();
+    }
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+    }
+    wake.notify_one();
+    return ++posted;
+}
+
+uint64_t SimulationEngine::setRunning(bool run) {
+    return post([this, run](Simulation&) { running = run; });
+}
+
+uint64_t SimulationEngine::showHistoryFrame(int index) {
+    return post([this, index](Simulation&) { historyIndex = index; });
+}
+
+bool SimulationEngine::update() {
+    return frames.update();
+}
+
+const EngineFrame& SimulationEngine::getFrame() const {
+    return frames.getFront();
+}
@@ -0,0 +1,185 @@
+#include "SnapshotRing.h"
+#include <iostream>
+
+void HistoryBacklog::add(const BoxSnapshot& snapshot) {
+    Item item;
+    item.snapshot = snapshot;
+    item.isSpilled = false;
+    items.push_back(item);
+}
+
+void HistoryBacklog::addSpilled(const SpilledFrame& frame, const std::shared_ptr<SpillReader>& spillReader) {
+    Item item;
+    item.spilled = frame;
+    item.isSpilled = true;
+    items.push_back(item);
+    reader = spillReader;
+}
+
+size_t HistoryBacklog::size() const {
+    return items.size();
+}
+
+int HistoryBacklog::getStep(size_t index) const {
+    return items[index].isSpilled ? items[index].spilled.step : items[index].snapshot.getStep();
+}
+
+bool HistoryBacklog::getFrame(size_t index, BoxSnapshot& frame) const {
+    const Item& item = items[index];
+    if (!item.isSpilled) {
+        frame = item.snapshot;
+        return true;
+    }
+    if (!reader || !reader->read(item.spilled, buffer)) {
+        return false;
+    }
+    frame = BoxSnapshot(item.spilled.step, item.spilled.boxSize, buffer.data(), buffer.size());
+    return true;
+}
+
+SnapshotRing::SnapshotRing() : quantised(false), particlesPerFrame(0), capacity(0), head(0), count(0) {}
+
+void SnapshotRing::configure(size_t particles, size_t frames, bool quantise) {
+    particlesPerFrame = particles;
+    capacity = frames > 0 ? frames : 1;
+    quantised = quantise;
+    slots.assign(quantised ? 0 : capacity, BoxSnapshot());
+    quantisedSlots.assign(quantised ? capacity : 0, QuantisedFrame());
+    clear();
+}
+
+void SnapshotRing::configureBytes(size_t particles, size_t bytes, bool quantise) {
+    size_t frameBytes = particles * (quantise ? 3 * sizeof(uint16_t) : sizeof(Particle));
+    configure(particles, frameBytes > 0 ? bytes / frameBytes : 1, quantise);
+}
+
+bool SnapshotRing::setSpillDirectory(const std::string& directory) {
+    if (directory.empty()) {
+        spill.close();
+        return true;
+    }
+    return spill.open(directory);
+}
+
+void SnapshotRing::push(const BoxSnapshot& snapshot) {
+    if (count == capacity && spill.isOpen()) {
+        bool spilled = quantised ? spill.append(quantisedSlots[head]) : spill.append(slots[head]);
+        if (!spilled) {
+            std::cerr << "History frame at step " << getStep(spill.size()) << " could not be spilled and is dropped"
+                      << std::endl;
+        }
+    }
+    if (quantised) {
+        quantisedSlots[head].encode(snapshot);
+    } else {
+        slots[head] = snapshot;
+    }
+    newest = snapshot;
+    head = (head + 1) % capacity;
+    if (count < capacity) {
+        count++;
+    }
+}
+
+void SnapshotRing::clear() {
+    for (size_t s = 0; s < slots.size(); s++) {
+        slots[s].clear();
+    }
+    for (size_t s = 0; s < quantisedSlots.size(); s++) {
+        quantisedSlots[s].clear();
+    }
+    newest.clear();
+    head = 0;
+    count = 0;
+    spill.clear();
+}
+
+size_t SnapshotRing::size() const {
+    return spill.size() + count;
+}
+
+size_t SnapshotRing::getCapacity() const {
+    return capacity;
+}
+
+size_t SnapshotRing::getParticlesPerFrame() const {
+    return particlesPerFrame;
+}
+
+bool SnapshotRing::isQuantised() const {
+    return quantised;
+}
+
+bool SnapshotRing::isSpilling() const {
+    return spill.isOpen();
+}
+
+size_t SnapshotRing::getSpilledFrames() const {
+    return spill.size();
+}
+
+uint64_t SnapshotRing::getSpilledBytes() const {
+    return spill.getBytes();
+}
+
+size_t SnapshotRing::getSlot(size_t index) const {
+    return (head + capacity - count + index) % capacity;
+}
+
+BoxSnapshot SnapshotRing::getFrame(size_t index) const {
+    if (index < spill.size()) {
+        return spill.getFrame(index);
+    }
+    index -= spill.size();
+    if (index + 1 == count) {
+        return newest;
+    }
+    return quantised ? quantisedSlots[getSlot(index)].decode() : slots[getSlot(index)];
+}
+
+void SnapshotRing::getQuantisedFrame(size_t index, QuantisedFrame& frame) const {
+    if (index < spill.size()) {
+        spill.getQuantisedFrame(index, frame);
+    } else if (quantised) {
+        frame = quantisedSlots[getSlot(index - spill.size())];
+    } else {
+        frame.encode(slots[getSlot(index - spill.size())]);
+    }
+}
+
+int SnapshotRing::getStep(size_t index) const {
+    if (index < spill.size()) {
+        return spill.getStep(index);
+    }
+    size_t slot = getSlot(index - spill.size());
+    return quantised ? quantisedSlots[slot].getStep() : slots[slot].getStep();
+}
+
+// A quantised history has only its newest frame at full precision
+void SnapshotRing::getFramesAfter(int step, HistoryBacklog& backlog) const {
+    if (quantised) {
+        if (count > 0 && newest.getStep() > step) {
+            backlog.add(newest);
+        }
+        return;
+    }
+    std::shared_ptr<SpillReader> reader;
+    for (size_t f = 0; f < spill.size(); f++) {
+        SpilledFrame location;
+        if (spill.getStep(f) > step && spill.locate(f, location)) {
+            if (!reader) {
+                reader = spill.share();
+            }
+            backlog.addSpilled(location, reader);
+        }
+    }
+    for (size_t f = 0; f < count; f++) {
+        if (slots[getSlot(f)].getStep() > step) {
+            backlog.add(f + 1 == count ? newest : slots[getSlot(f)]);
+        }
+    }
+}
+
+const BoxSnapshot& SnapshotRing::back() const {
+    return newest;
+}
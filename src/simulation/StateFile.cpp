@@ -0,0 +1,312 @@
+#include "StateFile.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+const char STATE_MAGIC[8] = {'M', 'C', 'S', 'M', 'S', 'T', 'A', 'T'};
+const uint32_t STATE_VERSION = 1;
+const size_t MIN_CAPACITY = 1024;
+
+uint64_t bytesFor(uint64_t capacity) {
+    return StateFile::DATA_OFFSET + capacity * sizeof(Particle);
+}
+
+// Changes on every boot, so a page cache that outlived its writer can be told
+// apart from one lost with the machine
+void readBootId(char (&bootId)[40]) {
+    std::memset(bootId, 0, sizeof(bootId));
+    std::ifstream file("/proc/sys/kernel/random/boot_id");
+    file.read(bootId, sizeof(bootId) - 1);
+}
+
+// Allocates the blocks up front where the file system can, so a full disk is
+// reported here rather than as a SIGBUS when the mapping is written
+bool growFile(int fd, uint64_t bytes) {
+    int result = posix_fallocate(fd, 0, bytes);
+    if (result == EOPNOTSUPP || result == EINVAL) {
+        result = ftruncate(fd, bytes) == 0 ? 0 : errno;
+    }
+    if (result != 0) {
+        std::cerr << "Error growing state file: " << std::strerror(result) << std::endl;
+        return false;
+    }
+    return true;
+}
+}
+
+StateFile::StateFile() : fd(-1), data(nullptr), mappedBytes(0), writable(false), consistent(false) {}
+
+StateFile::~StateFile() {
+    close();
+}
+
+StateFileHeader* StateFile::header() {
+    return reinterpret_cast<StateFileHeader*>(data);
+}
+
+const StateFileHeader* StateFile::header() const {
+    return reinterpret_cast<const StateFileHeader*>(data);
+}
+
+bool StateFile::map(uint64_t bytes) {
+    void* mapping = data == nullptr
+                        ? mmap(nullptr, bytes, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0)
+                        : mremap(data, mappedBytes, bytes, MREMAP_MAYMOVE);
+    if (mapping == MAP_FAILED) {
+        std::cerr << "Error mapping state file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    data = static_cast<char*>(mapping);
+    mappedBytes = bytes;
+    return true;
+}
+
+bool StateFile::create(const std::string& filename, size_t capacity) {
+    close();
+    capacity = std::max(capacity, MIN_CAPACITY);
+    // A new inode rather than truncation, so readers still attached to the old file are not cut short
+    ::unlink(filename.c_str());
+    fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Error creating state file " << filename << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    writable = true;
+    if (!growFile(fd, bytesFor(capacity)) || !map(bytesFor(capacity))) {
+        close();
+        return false;
+    }
+    StateFileHeader* h = header();
+    std::memset(h, 0, sizeof(StateFileHeader));
+    std::memcpy(h->magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+    h->version = STATE_VERSION;
+    h->capacity = capacity;
+    h->syncedStep = -1;
+    readBootId(h->bootId);
+    consistent = true;
+    return true;
+}
+
+// Only the header is read; the positions are paged in as they are first used
+bool StateFile::open(const std::string& filename) {
+    close();
+    fd = ::open(filename.c_str(), O_RDWR);
+    writable = true;
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || static_cast<uint64_t>(status.st_size) < DATA_OFFSET ||
+        !map(status.st_size)) {
+        std::cerr << "Error opening state file " << filename << std::endl;
+        close();
+        return false;
+    }
+    StateFileHeader* h = header();
+    if (std::memcmp(h->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 || h->version != STATE_VERSION ||
+        bytesFor(h->capacity) > mappedBytes || h->particleCount > h->capacity) {
+        std::cerr << filename << " is not a version " << STATE_VERSION << " state file" << std::endl;
+        close();
+        return false;
+    }
+
+    // After a crash of the process the page cache still holds every write, so
+    // the positions match the totals unless it died between an update and its
+    // commit. After a crash of the machine only what sync() wrote is certain,
+    // and pages written back since may belong to later steps.
+    char bootId[40];
+    readBootId(bootId);
+    consistent = h->closedCleanly ||
+                 ((h->sequence & 1) == 0 && std::memcmp(bootId, h->bootId, sizeof(bootId)) == 0);
+    h->closedCleanly = 0;
+    std::memcpy(h->bootId, bootId, sizeof(bootId));
+    if (h->sequence & 1) {
+        h->sequence++;
+    }
+    return true;
+}
+
+bool StateFile::attach(const std::string& filename) {
+    close();
+    fd = ::open(filename.c_str(), O_RDONLY);
+    writable = false;
+    struct stat status;
+    if (fd < 0 || fstat(fd, &status) != 0 || static_cast<uint64_t>(status.st_size) < DATA_OFFSET ||
+        !map(status.st_size)) {
+        std::cerr << "Error opening state file " << filename << std::endl;
+        close();
+        return false;
+    }
+    if (std::memcmp(header()->magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0 || header()->version != STATE_VERSION) {
+        std::cerr << filename << " is not a version " << STATE_VERSION << " state file" << std::endl;
+        close();
+        return false;
+    }
+    char bootId[40];
+    readBootId(bootId);
+    consistent = header()->closedCleanly || std::memcmp(bootId, header()->bootId, sizeof(bootId)) == 0;
+    return true;
+}
+
+void StateFile::close() {
+    if (data != nullptr) {
+        if (writable && sync() && (header()->sequence & 1) == 0) {
+            header()->closedCleanly = 1;
+            msync(data, DATA_OFFSET, MS_SYNC);
+        }
+        munmap(data, mappedBytes);
+        data = nullptr;
+    }
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+    mappedBytes = 0;
+    writable = false;
+}
+
+bool StateFile::isOpen() const {
+    return data != nullptr;
+}
+
+bool StateFile::isWritable() const {
+    return writable;
+}
+
+bool StateFile::reserve(size_t particles) {
+    if (particles <= header()->capacity) {
+        return true;
+    }
+    uint64_t capacity = std::max<uint64_t>(particles, 2 * header()->capacity);
+    if (!growFile(fd, bytesFor(capacity)) || !map(bytesFor(capacity))) {
+        return false;
+    }
+    header()->capacity = capacity;
+    return true;
+}
+
+void StateFile::resize(size_t particles) {
+    beginUpdate();
+    header()->particleCount = particles;
+}
+
+void StateFile::setBoxSize(double size) {
+    beginUpdate();
+    header()->boxSize = size;
+}
+
+// Seqlock writer: the sequence turns odd before the first change and even
+// again at the commit, with release ordering on both sides of the changes
+void StateFile::beginUpdate() {
+    StateFileHeader* h = header();
+    uint64_t sequence = h->sequence;
+    if ((sequence & 1) == 0) {
+        __atomic_store_n(&h->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+    }
+}
+
+void StateFile::commit(int step, double energy, double virial, double beta, double stepSize) {
+    beginUpdate();
+    StateFileHeader* h = header();
+    h->step = step;
+    h->energy = energy;
+    h->virial = virial;
+    h->beta = beta;
+    h->stepSize = stepSize;
+    __atomic_store_n(&h->sequence, h->sequence + 1, __ATOMIC_RELEASE);
+}
+
+// Called between commits, so what reaches the disk belongs to the committed step
+bool StateFile::sync() {
+    if (!writable) {
+        return false;
+    }
+    header()->syncedStep = header()->step;
+    if (msync(data, mappedBytes, MS_SYNC) != 0 || fsync(fd) != 0) {
+        std::cerr << "Error syncing state file: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+Particle* StateFile::getParticles() {
+    return reinterpret_cast<Particle*>(data + DATA_OFFSET);
+}
+
+const Particle* StateFile::getParticles() const {
+    return reinterpret_cast<const Particle*>(data + DATA_OFFSET);
+}
+
+size_t StateFile::getParticleCount() const {
+    return std::min<uint64_t>(header()->particleCount, getCapacity());
+}
+
+// A reader's mapping stays the size the file had at attach()
+size_t StateFile::getCapacity() const {
+    return std::min<uint64_t>(header()->capacity, (mappedBytes - DATA_OFFSET) / sizeof(Particle));
+}
+
+double StateFile::getBoxSize() const {
+    return header()->boxSize;
+}
+
+int StateFile::getStep() const {
+    return static_cast<int>(header()->step);
+}
+
+double StateFile::getEnergy() const {
+    return header()->energy;
+}
+
+double StateFile::getVirial() const {
+    return header()->virial;
+}
+
+double StateFile::getBeta() const {
+    return header()->beta;
+}
+
+double StateFile::getStepSize() const {
+    return header()->stepSize;
+}
+
+int StateFile::getSyncedStep() const {
+    return static_cast<int>(header()->syncedStep);
+}
+
+uint64_t StateFile::getSequence() const {
+    return __atomic_load_n(&header()->sequence, __ATOMIC_ACQUIRE);
+}
+
+bool StateFile::isConsistent() const {
+    return consistent;
+}
+
+uint64_t StateFile::getBytes() const {
+    return mappedBytes;
+}
+
+bool StateFile::readConfiguration(std::vector<Particle>& particles, int& step, double& boxSize, int attempts) const {
+    for (int attempt = 0; attempt < attempts; attempt++) {
+        uint64_t before = getSequence();
+        if (before & 1) {
+            std::this_thread::yield();
+            continue;
+        }
+        const Particle* positions = getParticles();
+        particles.assign(positions, positions + getParticleCount());
+        step = getStep();
+        boxSize = getBoxSize();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header()->sequence, __ATOMIC_RELAXED) == before) {
+            return true;
+        }
+    }
+    return false;
+}
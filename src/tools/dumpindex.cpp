@@ -0,0 +1,40 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "LammpsFrameIndex.h"
+
+// Builds or refreshes the sidecar frame index (<dump>.idx) of LAMMPS text dumps
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: dumpindex [--rebuild] <dump>...\n"
+                  << "  Writes <dump>.idx with the byte offset and timestep of every frame.\n"
+                  << "  An existing index is reused, or extended if the dump has grown.\n"
+                  << "  --rebuild  rescan every dump from the start\n";
+        return 1;
+    }
+    bool rebuild = false;
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--rebuild") == 0) {
+            rebuild = true;
+            continue;
+        }
+        std::string dump = argv[i];
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        LammpsFrameIndex index;
+        bool ok = rebuild ? index.build(dump) && index.save(LammpsFrameIndex::sidecarFilename(dump)) : index.open(dump);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ok) {
+            std::cerr << dump << ": indexing failed" << std::endl;
+            status = 1;
+            continue;
+        }
+        std::cout << dump << ": " << index.getFrameCount() << " frames";
+        if (index.getFrameCount() > 0) {
+            std::cout << ", steps " << index.getStep(0) << " to " << index.getStep(index.getFrameCount() - 1);
+        }
+        std::cout << " (" << seconds << " s)" << std::endl;
+    }
+    return status;
+}
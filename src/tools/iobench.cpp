@@ -0,0 +1,134 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "AsyncFile.h"
+#include "TrajectorySink.h"
+
+namespace {
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+bool syncFile(const std::string& filename) {
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    bool ok = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    return ok;
+}
+
+void report(const char* path, double bytes, double seconds) {
+    std::printf("%-28s %8.3f s  %8.1f MB/s\n", path, seconds, bytes / seconds / 1048576.0);
+}
+
+// Frames as saveParticles wrote them before the asynchronous path: one ofstream write per frame
+double writeOfstream(const std::string& filename, const std::vector<Particle>& particles, int frames) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    for (int f = 0; f < frames; f++) {
+        out.write(reinterpret_cast<const char*>(particles.data()), particles.size() * sizeof(Particle));
+    }
+    out.close();
+    syncFile(filename);
+    return secondsSince(start);
+}
+
+double writeAsync(const std::string& filename, const std::vector<Particle>& particles, int frames,
+                  AsyncFile::Backend backend, AsyncFile::Backend& used) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    AsyncFile file;
+    file.open(filename, false, backend);
+    used = file.getBackend();
+    for (int f = 0; f < frames; f++) {
+        file.write(particles.data(), particles.size() * sizeof(Particle));
+    }
+    file.sync();
+    file.close();
+    return secondsSince(start);
+}
+
+// The full LAMMPS text path: parallel formatting plus the selected AsyncFile backend
+double writeDump(const std::string& filename, const std::vector<Particle>& particles, int frames) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    LammpsDumpSink sink(false);
+    sink.open(filename, 100.0);
+    Frame frame;
+    frame.particles = particles.data();
+    frame.count = particles.size();
+    for (int f = 0; f < frames; f++) {
+        frame.step = f;
+        sink.write(frame);
+    }
+    sink.close();
+    syncFile(filename);
+    return secondsSince(start);
+}
+}
+
+// Compares the trajectory output paths on one file system
+int main(int argc, char** argv) {
+    size_t particles = 1000000;
+    int frames = 20;
+    bool text = false;
+    std::string filename;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--particles") == 0 && i + 1 < argc) {
+            particles = std::strtoull(argv[++i], nullptr, 10);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = std::atoi(argv[++i]);
+        } else if (std::strcmp(argv[i], "--text") == 0) {
+            text = true;
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename.empty() || particles == 0 || frames <= 0) {
+        std::cerr << "Usage: iobench [--particles N] [--frames F] [--text] <scratch file>\n"
+                  << "  Writes F frames of N particles through std::ofstream, the pwrite thread and\n"
+                  << "  io_uring, each followed by fsync, and reports the throughput.\n"
+                  << "  --text  also writes LAMMPS dumps through each backend\n";
+        return 1;
+    }
+
+    std::vector<Particle> positions(particles);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> uniform(0.0, 100.0);
+    for (size_t i = 0; i < particles; i++) {
+        positions[i] = Particle(uniform(rng), uniform(rng), uniform(rng));
+    }
+    double bytes = static_cast<double>(particles) * sizeof(Particle) * frames;
+    std::printf("%zu particles, %d frames, %.1f MB per run\n", particles, frames, bytes / 1048576.0);
+
+    report("ofstream", bytes, writeOfstream(filename, positions, frames));
+    const AsyncFile::Backend backends[] = {AsyncFile::PWRITE_THREAD, AsyncFile::IO_URING};
+    for (int b = 0; b < 2; b++) {
+        AsyncFile::Backend used;
+        double seconds = writeAsync(filename, positions, frames, backends[b], used);
+        if (used != backends[b]) {
+            std::printf("%-28s unavailable\n", AsyncFile::getBackendName(backends[b]));
+            continue;
+        }
+        report(AsyncFile::getBackendName(used), bytes, seconds);
+    }
+
+    if (text) {
+        for (int b = 0; b < 2; b++) {
+            AsyncFile::setDefaultBackend(backends[b]);
+            std::string label = std::string("LAMMPS dump, ") + AsyncFile::getBackendName(backends[b]);
+            double seconds = writeDump(filename, positions, frames);
+            std::ifstream written(filename, std::ios::binary | std::ios::ate);
+            report(label.c_str(), static_cast<double>(written.tellg()), seconds);
+        }
+    }
+    std::remove(filename.c_str());
+    return 0;
+}
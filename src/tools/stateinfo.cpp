@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "StateFile.h"
+
+namespace {
+void report(const StateFile& state) {
+    size_t count = state.getParticleCount();
+    double perParticle = count > 0 ? 1.0 / count : 0.0;
+    std::printf("step %d (synced %d), %zu particles, box %.6g, E/N %.6f, W/N %.6f, T %.4g%s\n", state.getStep(),
+                state.getSyncedStep(), count, state.getBoxSize(), state.getEnergy() * perParticle,
+                state.getVirial() * perParticle, state.getBeta() > 0.0 ? 1.0 / state.getBeta() : 0.0,
+                state.isConsistent() ? "" : " (not closed cleanly)");
+}
+
+bool writeXyz(const std::string& filename, const std::vector<Particle>& particles, int step, double boxSize) {
+    std::ofstream out(filename);
+    out << particles.size() << "\n"
+        << "Lattice=\"" << boxSize << " 0 0 0 " << boxSize << " 0 0 0 " << boxSize << "\" Step=" << step << "\n";
+    for (size_t i = 0; i < particles.size(); i++) {
+        out << "A " << particles[i].x << " " << particles[i].y << " " << particles[i].z << "\n";
+    }
+    out.close();
+    return static_cast<bool>(out);
+}
+}
+
+// Attaches read-only to the live state file of a running simulation
+int main(int argc, char** argv) {
+    double watchSeconds = 0.0;
+    std::string xyz;
+    std::string filename;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watchSeconds = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--xyz") == 0 && i + 1 < argc) {
+            xyz = argv[++i];
+        } else {
+            filename = argv[i];
+        }
+    }
+    if (filename.empty()) {
+        std::cerr << "Usage: stateinfo [--watch SECONDS] [--xyz FILE] <state file>\n"
+                  << "  Prints the step, size and totals of a .mcstate file, which may be in use.\n"
+                  << "  --watch  repeat every SECONDS until interrupted\n"
+                  << "  --xyz    write a consistent copy of the configuration as extended XYZ\n";
+        return 1;
+    }
+
+    StateFile state;
+    if (!state.attach(filename)) {
+        return 1;
+    }
+    report(state);
+    if (!xyz.empty()) {
+        std::vector<Particle> particles;
+        int step;
+        double boxSize;
+        if (!state.readConfiguration(particles, step, boxSize) || !writeXyz(xyz, particles, step, boxSize)) {
+            std::cerr << "Could not copy a consistent configuration to " << xyz << std::endl;
+            return 1;
+        }
+        std::cout << "Step " << step << " written to " << xyz << std::endl;
+    }
+    while (watchSeconds > 0.0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(watchSeconds));
+        report(state);
+    }
+    return 0;
+}
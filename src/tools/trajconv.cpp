@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "BinaryTrajectory.h"
+#include "CompressedTrajectory.h"
+#include "MoveLog.h"
+
+namespace {
+bool hasExtension(const std::string& filename, const std::string& extension) {
+    return filename.size() >= extension.size() &&
+           filename.compare(filename.size() - extension.size(), extension.size(), extension) == 0;
+}
+}
+
+// Converts between LAMMPS text dumps, binary trajectories (.mctraj) and compressed trajectories (.mcz),
+// and replays move logs (.mclog) into any of them
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: trajconv <input> <output> [--float] [--precision p] [--frames first[:last]] [--every n]\n"
+                  << "  Converts a LAMMPS dump to .mctraj or .mcz (chosen by the output extension),\n"
+                  << "  or back to a LAMMPS dump when the input is .mctraj or .mcz\n"
+                  << "  --float        store .mctraj coordinates in single precision\n"
+                  << "  --precision p  .mcz quantisation step relative to the box length (default 1e-4)\n"
+                  << "  --frames f[:l] convert only frames f to l (from 0, inclusive; default to the end);\n"
+                  << "                 a LAMMPS input is entered at frame f through its sidecar index\n"
+                  << "  A .mclog input is rebuilt step by step into the format of the output extension;\n"
+                  << "  --frames then selects steps, and\n"
+                  << "  --every n      writes every n-th step (default: the keyframes only)\n";
+        return 1;
+    }
+    std::string input = argv[1];
+    std::string output = argv[2];
+    int bytes = 8;
+    double precision = 1e-4;
+    size_t first = 0;
+    size_t last = SIZE_MAX;
+    int every = 0;
+    for (int i = 3; i < argc; i++) {
+        if (std::strcmp(argv[i], "--float") == 0) {
+            bytes = 4;
+        } else if (std::strcmp(argv[i], "--precision") == 0 && i + 1 < argc) {
+            precision = std::atof(argv[++i]);
+        } else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            char* rest;
+            first = std::strtoull(argv[++i], &rest, 10);
+            if (*rest == ':') {
+                last = std::strtoull(rest + 1, nullptr, 10);
+            }
+        } else if (std::strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            every = std::atoi(argv[++i]);
+        }
+    }
+
+    bool ok;
+    if (hasExtension(input, ".mclog")) {
+        ok = convertMoveLog(input, output, static_cast<int>(std::min<size_t>(first, INT_MAX)),
+                            static_cast<int>(std::min<size_t>(last, INT_MAX)), every);
+    } else if (hasExtension(input, ".mctraj")) {
+        ok = convertBinaryToLammps(input, output, first, last);
+    } else if (hasExtension(input, ".mcz")) {
+        ok = convertCompressedToLammps(input, output, first, last);
+    } else if (hasExtension(output, ".mcz")) {
+        ok = convertLammpsToCompressed(input, output, precision, first, last);
+    } else {
+        ok = convertLammpsToBinary(input, output, bytes, first, last);
+    }
+    return ok ? 0 : 1;
+}